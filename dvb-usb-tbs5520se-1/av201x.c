@@ -20,6 +20,29 @@
 
 #include "av201x_priv.h"
 
+static int wide_acq;
+module_param(wide_acq, int, 0644);
+MODULE_PARM_DESC(wide_acq, "widen the filter by this many percent until "
+		"the demod locks (default: 0)");
+
+/* keep the shadow of written registers, NULL data forgets them */
+static void av201x_shadow(struct i2c_client *client, u8 addr,
+				const u8 *data, int len)
+{
+	struct av201x_dev *dev = i2c_get_clientdata(client);
+	int i;
+
+	for (i = 0; i < len && addr + i < AV201X_NREGS; i++) {
+		dev->regs_dirty &= ~BIT_ULL(addr + i);
+		if (data) {
+			dev->regs[addr + i] = data[i];
+			dev->regs_cached |= BIT_ULL(addr + i);
+		} else {
+			dev->regs_cached &= ~BIT_ULL(addr + i);
+		}
+	}
+}
+
 /* write multiple (continuous) registers */
 static int av201x_wrm(struct i2c_client *client, char *buf, int len)
 {
@@ -36,8 +59,10 @@ static int av201x_wrm(struct i2c_client *client, char *buf, int len)
 		dev_warn(&client->dev,
 			"%s: i2c wrm err(%i) @0x%02x (len=%d)\n",
 			KBUILD_MODNAME, ret, buf[0], len);
+		av201x_shadow(client, buf[0], NULL, len - 1);
 		return ret;
 	}
+	av201x_shadow(client, buf[0], buf + 1, len - 1);
 	return 0;
 }
 
@@ -78,6 +103,19 @@ static int av201x_rd(struct i2c_client *client, u8 addr, u8 *data)
 	return av201x_rdm(client, addr, data, 1);
 }
 
+/* current value of a register, from the shadow when it is known */
+static int av201x_rd_cached(struct i2c_client *client, u8 reg, u8 *data)
+{
+	struct av201x_dev *dev = i2c_get_clientdata(client);
+
+	if (reg != REG_TUNER_STAT && reg < AV201X_NREGS &&
+	    (dev->regs_cached & BIT_ULL(reg))) {
+		*data = dev->regs[reg];
+		return 0;
+	}
+	return av201x_rd(client, reg, data);
+}
+
 /* read register, apply masks, write back */
 static int av201x_regmask(struct i2c_client *client,
 	u8 reg, u8 setmask, u8 clrmask)
@@ -85,7 +123,7 @@ static int av201x_regmask(struct i2c_client *client,
 	int ret;
 	u8 b = 0;
 	if (clrmask != 0xff) {
-		ret = av201x_rd(client, reg, &b);
+		ret = av201x_rd_cached(client, reg, &b);
 		if (ret)
 			return ret;
 		b &= ~clrmask;
@@ -93,21 +131,106 @@ static int av201x_regmask(struct i2c_client *client,
 	return av201x_wr(client, reg, b | setmask);
 }
 
+/* write the dirty registers of the shadow, contiguous ones in one burst */
+static int av201x_flush(struct i2c_client *client)
+{
+	struct av201x_dev *dev = i2c_get_clientdata(client);
+	u8 buf[AV201X_BURST_MAX + 1];
+	int ret, reg, n;
+
+	for (reg = 0; reg < AV201X_NREGS; reg += n) {
+		n = 0;
+		while (reg + n < AV201X_NREGS && n < AV201X_BURST_MAX &&
+		       (dev->regs_dirty & BIT_ULL(reg + n))) {
+			buf[1 + n] = dev->regs[reg + n];
+			n++;
+		}
+		if (!n) {
+			n = 1;
+			continue;
+		}
+		buf[0] = reg;
+		ret = av201x_wrm(client, buf, n + 1);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/*
+ * Stage a register table in the shadow, flushing it in bursts before any
+ * entry that asks for a delay.
+ */
 static int av201x_wrtable(struct i2c_client *client,
 	struct av201x_regtable *regtable, int len)
 {
+	struct av201x_dev *dev = i2c_get_clientdata(client);
 	int ret, i;
+	u8 b;
 
 	for (i = 0; i < len; i++) {
-		ret = av201x_regmask(client, regtable[i].addr,
-			regtable[i].setmask, regtable[i].clrmask);
+		u8 reg = regtable[i].addr;
+
+		if (reg >= AV201X_NREGS) {
+			ret = av201x_flush(client);
+			if (!ret)
+				ret = av201x_regmask(client, reg,
+					regtable[i].setmask,
+					regtable[i].clrmask);
+			if (ret)
+				return ret;
+			continue;
+		}
+
+		b = 0;
+		if (regtable[i].clrmask != 0xff) {
+			ret = av201x_rd_cached(client, reg, &b);
+			if (ret)
+				return ret;
+			b &= ~regtable[i].clrmask;
+		}
+		dev->regs[reg] = b | regtable[i].setmask;
+		dev->regs_dirty |= BIT_ULL(reg);
+
+		if (regtable[i].sleep) {
+			ret = av201x_flush(client);
+			if (ret)
+				return ret;
+			msleep(regtable[i].sleep);
+		}
+	}
+	return 0;
+}
+
+/* poll the PLL lock bit after a tune, recording how long it took */
+static int av201x_wait_lock(struct i2c_client *client)
+{
+	struct av201x_dev *dev = i2c_get_clientdata(client);
+	ktime_t start = ktime_get();
+	ktime_t timeout = ktime_add_ms(start, AV201X_LOCK_TIMEOUT);
+	u8 stat;
+	int ret;
+
+	for (;;) {
+		ret = av201x_rd(client, REG_TUNER_STAT, &stat);
 		if (ret)
 			return ret;
-		if (regtable[i].sleep)
-			msleep(regtable[i].sleep);
+		if (stat & AV201X_PLLLOCK)
+			break;
+		if (ktime_after(ktime_get(), timeout)) {
+			dev->lock_timeouts++;
+			dev_dbg(&client->dev, "PLL lock timeout\n");
+			return 0;
+		}
+		usleep_range(AV201X_LOCK_POLL_US, AV201X_LOCK_POLL_US * 2);
 	}
+
+	dev->lock_us = ktime_us_delta(ktime_get(), start);
+	if (dev->lock_us > dev->lock_us_max)
+		dev->lock_us_max = dev->lock_us;
+	dev_dbg(&client->dev, "PLL locked in %u us\n", dev->lock_us);
 	return 0;
-} 
+}
 
 static int av201x_init(struct dvb_frontend *fe)
 {
@@ -117,6 +240,7 @@ static int av201x_init(struct dvb_frontend *fe)
 
 	dev_dbg(&client->dev, "\n");
 
+	/* the tables are staged and written in two bursts */
 	ret = av201x_wrtable(client, av201x_inittuner0,
 		ARRAY_SIZE(av201x_inittuner0));
 
@@ -134,6 +258,7 @@ static int av201x_init(struct dvb_frontend *fe)
 
 	ret |= av201x_wrtable(client, av201x_inittuner2,
 		ARRAY_SIZE(av201x_inittuner2));
+	ret |= av201x_flush(client);
 
 	ret |= av201x_wr(client, REG_TUNER_CTRL, 0x96);
 
@@ -161,51 +286,34 @@ static int av201x_sleep(struct dvb_frontend *fe)
 	return ret; 	
 }
 
-static int av201x_set_params(struct dvb_frontend *fe)
+/*
+ * PLL setup
+ * RF = (pll_N * ref_freq) / pll_M
+ * pll_M = fixed 0x10000
+ * PLL output is divided by 2
+ * REG_FN = pll_M<24:0>
+ */
+static int av201x_set_pll(struct i2c_client *client, u32 frequency)
 {
-	struct i2c_client *client = fe->tuner_priv;
 	struct av201x_dev *dev = i2c_get_clientdata(client);
-	struct dtv_frontend_properties *c = &fe->dtv_property_cache;
-
-	u32 n, bw, bf;
+	u32 n;
 	u8 buf[5];
-	int ret;
 
-	dev_dbg(&client->dev, "%s() delivery_system=%d frequency=%d " \
-			"symbol_rate=%d\n", __func__,
-			c->delivery_system, c->frequency, c->symbol_rate);
-
-	if (!dev->active) {
-		ret = -EAGAIN;
-		goto exit;
-	}
-
-	/*
-	   ** PLL setup **
-	   RF = (pll_N * ref_freq) / pll_M
-	   pll_M = fixed 0x10000
-	   PLL output is divided by 2
-	   REG_FN = pll_M<24:0>
-	*/
 	buf[0] = REG_FN;
-	n = DIV_ROUND_CLOSEST(c->frequency, dev->xtal_freq);
+	n = DIV_ROUND_CLOSEST(frequency, dev->xtal_freq);
 	buf[1] = (n > 0xff) ? 0xff : (u8) n;
-	n = DIV_ROUND_CLOSEST((c->frequency / 1000) << 17, dev->xtal_freq / 1000);
+	n = DIV_ROUND_CLOSEST((frequency / 1000) << 17, dev->xtal_freq / 1000);
 	buf[2] = (u8) (n >> 9);
 	buf[3] = (u8) (n >> 1);
 	buf[4] = (u8) (((n << 7) & 0x80) | 0x50);
-	ret = av201x_wrm(client, buf, 5);
-	if (ret)
-		goto exit;
-
-	msleep(20);
+	return av201x_wrm(client, buf, 5);
+}
 
-	/* set bandwidth */
-	bw = (c->symbol_rate / 1000) * 135/200;
-	if (c->symbol_rate < 6500000)
-		bw += 6000;
-	bw += 2000;
-	bw *= 108/100;
+/* low pass filter bandwidth in kHz */
+static int av201x_set_lpf(struct i2c_client *client, u32 bw)
+{
+	u32 bf;
+	int ret;
 
 	/* check limits (4MHz < bw < 40MHz) */
 	if (bw > 40000)
@@ -221,13 +329,161 @@ static int av201x_set_params(struct dvb_frontend *fe)
 	ret |= av201x_wr(client, REG_FT_CTRL, AV201X_FT_EN | AV201X_FT_BLK);
 
 	ret |= av201x_wr(client, REG_TUNER_CTRL, 0x96);
-	msleep(20);
+	return ret;
+}
+
+/*
+ * Filter for a carrier: the occupied bandwidth SR * (1 + roll-off) / 2
+ * plus the drift margin of its symbol rate band, plus 8%. kHz.
+ */
+static u32 av201x_lpf_khz(struct dtv_frontend_properties *c)
+{
+	u32 sr = c->symbol_rate / 1000;
+	u32 ro, bw;
+	int i;
+
+	switch (c->rolloff) {
+	case ROLLOFF_20:
+		ro = 20;
+		break;
+	case ROLLOFF_25:
+		ro = 25;
+		break;
+	case ROLLOFF_15:
+		ro = 15;
+		break;
+	case ROLLOFF_10:
+		ro = 10;
+		break;
+	case ROLLOFF_5:
+		ro = 5;
+		break;
+	case ROLLOFF_35:
+	default:
+		/* DVB-S and auto use the widest */
+		ro = 35;
+		break;
+	}
+
+	bw = DIV_ROUND_UP(sr * (100 + ro), 200);
+	for (i = 0; i < ARRAY_SIZE(av201x_lpf_margins) - 1; i++)
+		if (sr < av201x_lpf_margins[i].sr_max)
+			break;
+	bw += av201x_lpf_margins[i].margin_khz;
+
+	return bw * 108 / 100;
+}
+
+static int av201x_set_params(struct dvb_frontend *fe)
+{
+	struct i2c_client *client = fe->tuner_priv;
+	struct av201x_dev *dev = i2c_get_clientdata(client);
+	struct dtv_frontend_properties *c = &fe->dtv_property_cache;
+
+	u32 bw;
+	int ret;
+
+	dev_dbg(&client->dev, "%s() delivery_system=%d frequency=%d " \
+			"symbol_rate=%d\n", __func__,
+			c->delivery_system, c->frequency, c->symbol_rate);
+
+	if (!dev->active) {
+		ret = -EAGAIN;
+		goto exit;
+	}
+
+	ret = av201x_set_pll(client, c->frequency);
+	if (ret)
+		goto exit;
+
+	/* set bandwidth, wider while acquiring if asked to */
+	bw = av201x_lpf_khz(c);
+	if (wide_acq > 0)
+		bw += bw * wide_acq / 100;
+
+	ret = av201x_set_lpf(client, bw);
+	dev->lpf_khz = bw;
+	if (!ret)
+		ret = av201x_wait_lock(client);
 exit:
 	if (ret)
 		dev_dbg(&client->dev, "%s() failed\n", __func__);
 	return ret; 
 }
 
+/*
+ * Retune the PLL only, for sweeps that keep the filter and do their own
+ * settling. frequency in kHz.
+ */
+static int av201x_set_frequency(struct dvb_frontend *fe, u32 frequency)
+{
+	struct i2c_client *client = fe->tuner_priv;
+	struct av201x_dev *dev = i2c_get_clientdata(client);
+	int ret;
+
+	if (!dev->active)
+		return -EAGAIN;
+
+	ret = av201x_set_pll(client, frequency);
+	if (!ret)
+		ret = av201x_wr(client, REG_TUNER_CTRL, 0x96);
+	return ret;
+}
+
+/* low pass filter only, bandwidth in Hz */
+static int av201x_set_bandwidth(struct dvb_frontend *fe, u32 bandwidth)
+{
+	struct i2c_client *client = fe->tuner_priv;
+	struct av201x_dev *dev = i2c_get_clientdata(client);
+	u32 bw = bandwidth / 1000;
+	int ret;
+
+	if (!dev->active)
+		return -EAGAIN;
+	if (bw == dev->lpf_khz)
+		return 0;
+
+	ret = av201x_set_lpf(client, bw);
+	dev->lpf_khz = ret ? 0 : bw;
+	return ret;
+}
+
+/* programmed low pass filter, in Hz */
+static int av201x_get_bandwidth(struct dvb_frontend *fe, u32 *bandwidth)
+{
+	struct i2c_client *client = fe->tuner_priv;
+	struct av201x_dev *dev = i2c_get_clientdata(client);
+
+	*bandwidth = dev->lpf_khz * 1000;
+	return 0;
+}
+
+static int av201x_get_status(struct dvb_frontend *fe, u32 *status)
+{
+	struct i2c_client *client = fe->tuner_priv;
+	u8 stat;
+	int ret;
+
+	*status = 0;
+	ret = av201x_rd(client, REG_TUNER_STAT, &stat);
+	if (ret)
+		return ret;
+	if (stat & AV201X_PLLLOCK)
+		*status = TUNER_STATUS_LOCKED;
+	return 0;
+}
+
+static ssize_t lock_time_show(struct device *device,
+				struct device_attribute *attr, char *buf)
+{
+	struct i2c_client *client = to_i2c_client(device);
+	struct av201x_dev *dev = i2c_get_clientdata(client);
+
+	return scnprintf(buf, PAGE_SIZE, "%u %u %u\n", dev->lock_us,
+			dev->lock_us_max, dev->lock_timeouts);
+}
+static DEVICE_ATTR_RO(lock_time);
+
 static  int   AV201x_agc         [] = {     0,  82,   100,  116,  140,  162,  173,  187,  210,  223,  254,  255};
 static  int   AV201x_level_dBm_10[] = {    90, -50,  -263, -361, -463, -563, -661, -761, -861, -891, -904, -910}; 
 
@@ -243,7 +499,7 @@ static int av201x_get_rf_strength(struct dvb_frontend *fe, u16 *st)
 
 
 	/* Finding in which segment the if_agc value is */
-	for (index = 0; index < table_length; index ++)
+	for (index = 1; index < table_length - 1; index ++)
 		if (x[index] > if_agc ) break;
 
 	/* Computing segment slope */
@@ -270,6 +526,10 @@ static const struct dvb_tuner_ops av201x_ops = {
 	.init = av201x_init,
 	.sleep = av201x_sleep,
 	.set_params = av201x_set_params,
+	.set_frequency = av201x_set_frequency,
+	.set_bandwidth = av201x_set_bandwidth,
+	.get_bandwidth = av201x_get_bandwidth,
+	.get_status = av201x_get_status,
 	.get_rf_strength = av201x_get_rf_strength,
 };
 
@@ -296,6 +556,10 @@ static int av201x_probe(struct i2c_client *client,
 	memcpy(&fe->ops.tuner_ops, &av201x_ops, sizeof(struct dvb_tuner_ops));
 	fe->tuner_priv = client;
 
+	/* last, slowest PLL lock time in us and lock timeouts */
+	if (device_create_file(&client->dev, &dev_attr_lock_time))
+		dev_warn(&client->dev, "failed to create lock_time\n");
+
 	dev_info(&client->dev, "Airoha Technology %s successfully attached\n",id->name);
 
 	return 0;
@@ -312,6 +576,7 @@ static int av201x_remove(struct i2c_client *client)
 
 	dev_dbg(&client->dev, "\n");
 	dev_dbg(&client->dev,"av201x_remove\n");
+	device_remove_file(&client->dev, &dev_attr_lock_time);
 	memset(&fe->ops.tuner_ops, 0, sizeof(struct dvb_tuner_ops));
 	fe->tuner_priv = NULL;
 	kfree(dev);
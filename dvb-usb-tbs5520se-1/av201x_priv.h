@@ -21,14 +21,36 @@
 #ifndef AV201X_PRIV_H
 #define AV201X_PRIV_H
 
+#include <linux/ktime.h>
 #include "av201x.h"
 
+/* register shadow, longest burst write in registers */
+#define AV201X_NREGS		0x2a
+#define AV201X_BURST_MAX	32
+
+/* PLL lock polling, ms and us */
+#define AV201X_LOCK_TIMEOUT	50
+#define AV201X_LOCK_POLL_US	500
+
 /* state struct */
 struct av201x_dev {
 	struct dvb_frontend *fe;
 	bool active;
 	int chiptype;
 	u32 xtal_freq;
+
+	/* PLL lock time of the last tune and the slowest one, in us */
+	u32 lock_us;
+	u32 lock_us_max;
+	u32 lock_timeouts;
+
+	/* programmed filter, kHz */
+	u32 lpf_khz;
+
+	/* last value written to each register, cached and dirty bitmaps */
+	u8 regs[AV201X_NREGS];
+	u64 regs_cached;
+	u64 regs_dirty;
 };
 
 enum av201x_regs_addr {
@@ -50,6 +72,17 @@ enum av201x_regs_addr {
 #define AV201X_FT_EN		(1<<1)
 #define AV201X_FT_BLK		(1<<2)
 
+/* LPF margin for LNB drift and tuner offset, by symbol rate in ksym/s */
+struct av201x_lpf_margin {
+	u32 sr_max;
+	u32 margin_khz;
+};
+
+static const struct av201x_lpf_margin av201x_lpf_margins[] = {
+	{  6500, 8000 },
+	{ 45000, 2000 },
+};
+
 struct av201x_regtable {
 	u8 addr;
 	u8 setmask;
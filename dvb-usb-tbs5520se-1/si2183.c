@@ -16,6 +16,10 @@
 #include <media/dvb_frontend.h>
 #include <linux/firmware.h>
 #include <linux/i2c-mux.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/sort.h>
 
 #define SI2183_B60_FIRMWARE "dvb-demod-si2183-b60-01.fw"
 
@@ -35,6 +39,188 @@
 #define SI2183_PROP_MCNS_SR	0x1602
 #define SI2183_PROP_MCNS_AFC	0x1603
 #define SI2183_PROP_DVBC2_AFC	0x1701
+#define SI2183_PROP_SCAN_FMIN	0x0303
+#define SI2183_PROP_SCAN_FMAX	0x0304
+#define SI2183_PROP_SCAN_SR_MIN	0x0305
+#define SI2183_PROP_SCAN_SR_MAX	0x0306
+
+/* scan engine */
+#define SI2183_SCAN_START	1
+#define SI2183_SCAN_CONTINUE	2
+#define SI2183_SCAN_ABORT	3
+
+#define SI2183_SCAN_IDLE	0
+#define SI2183_SCAN_SEARCHING	1
+#define SI2183_SCAN_ENDED	2
+#define SI2183_SCAN_ERROR	3
+#define SI2183_SCAN_TUNE_REQ	4
+#define SI2183_SCAN_FOUND	5
+
+#define SI2183_SCAN_MAX		128
+#define SI2183_SCAN_TIMEOUT	2000
+
+/* spectrum sweep, level in 0.001 dBm per bin */
+#define SI2183_SWEEP_MAX	4096
+#define SI2183_SWEEP_SETTLE_US	3000
+#define SI2183_SWEEP_LPF_MIN	4000	/* kHz */
+#define SI2183_SWEEP_LPF_MAX	40000
+
+/*
+ * Satellite tracking filter once locked: occupied bandwidth plus the LNB
+ * drift allowance of the symbol rate band, plus 8%. kHz and ksym/s.
+ */
+#define SI2183_TRACK_SR_LOW	6500
+#define SI2183_TRACK_MARGIN_LOW	8000
+#define SI2183_TRACK_MARGIN	2000
+
+struct si2183_sweep {
+	u32 start;		/* kHz */
+	u32 step;		/* kHz */
+	int num;
+	s32 level[];
+};
+
+/* terrestrial/cable pre-scan, occupied channels only */
+#define SI2183_PRESCAN_MAX	512
+#define SI2183_PRESCAN_SETTLE_MS	15
+#define SI2183_PRESCAN_FLOOR_DIV	10	/* floor percentile, 1/10 */
+
+struct si2183_prescan {
+	bool dbm;		/* level in 0.001 dBm, else -AGC */
+	int num;
+	struct {
+		u32 frequency;	/* kHz */
+		s32 level;
+	} ch[];
+};
+
+struct si2183_scan_result {
+	u32 frequency;		/* kHz */
+	u32 symbol_rate;	/* symbols/s */
+	enum fe_delivery_system delivery_system;
+};
+
+/* firmware images are a sequence of { len, data[16] } records */
+#define SI2183_FW_RECLEN	17
+
+/* properties written since power up */
+#define SI2183_PROP_SHADOW	32
+struct si2183_prop_shadow {
+	u16 prop;
+	u16 val;
+};
+
+/* fe thread poll interval while acquiring, at least one jiffy */
+#define SI2183_TUNE_FAST	max_t(unsigned int, HZ / 50, 1)
+
+/*
+ * Empty channel detection: the demod flags a signal that is not of the
+ * requested standard, or there is neither carrier nor RF at the tuner.
+ */
+#define SI2183_STAT_NOTSTD	0x20
+#define SI2183_NO_RF_MDB	(-85000)
+#define SI2183_EMPTY_MIN_MS	100
+
+/*
+ * Experimental and opt-in: the -85 dBm no-RF level and the timing above
+ * are estimates, not measured on this hardware, so it stays off by default.
+ */
+static int empty_polls;
+module_param(empty_polls, int, 0644);
+MODULE_PARM_DESC(empty_polls, "experimental, opt-in: report FE_TIMEDOUT "
+		"after this many polls that found no channel; thresholds are "
+		"not measured yet (0 = disabled, default: 0)");
+
+static int dvbt_auto;
+module_param(dvbt_auto, int, 0644);
+MODULE_PARM_DESC(dvbt_auto, "let the demod detect DVB-T or DVB-T2 on any "
+		"DVB-T/T2 tune and report the one found (default: 0)");
+
+static int dvbc_auto;
+module_param(dvbc_auto, int, 0644);
+MODULE_PARM_DESC(dvbc_auto, "on DVB-C tunes with symbol rate 1000000 (the "
+		"lowest accepted), detect symbol rate and annex and report "
+		"them (default: 0)");
+
+/*
+ * DVB-C symbol rate that asks for detection: dvb-core refuses 0 for annex
+ * A/C, and no cable plant runs at 1 Msym/s. Search range in ksym/s, J.83
+ * annex B rates in sym/s.
+ */
+#define SI2183_DVBC_SR_DETECT	1000000
+#define SI2183_DVBC_SR_MIN	1000
+#define SI2183_DVBC_SR_MAX	7200
+#define SI2183_MCNS_SR_64	5056941
+#define SI2183_MCNS_SR_256	5360537
+#define SI2183_MCNS_SR_TOL	50000
+
+/*
+ * Parameters of recently acquired channels, reused on a retune with a
+ * narrow AFC window. AFC ranges in kHz, full and narrowed; the T and S
+ * full ranges are the firmware defaults.
+ */
+#define SI2183_CACHE_SIZE	16
+#define SI2183_AFC_C		100
+#define SI2183_AFC_MCNS		200
+#define SI2183_AFC_T		550
+#define SI2183_AFC_S		4000
+#define SI2183_AFC_NARROW_TC	30
+#define SI2183_AFC_NARROW_S	500
+
+static int tune_cache = 1;
+module_param(tune_cache, int, 0644);
+MODULE_PARM_DESC(tune_cache, "retune known channels from their last "
+		"acquired parameters (default: 1)");
+
+struct si2183_cache_entry {
+	/* key, as requested */
+	enum fe_delivery_system key_delsys;
+	u32 key_frequency;
+	u32 key_rate;		/* symbol rate or bandwidth */
+
+	/* acquired */
+	enum fe_delivery_system delivery_system;
+	u32 symbol_rate;
+	enum fe_modulation modulation;
+	enum fe_spectral_inversion inversion;
+	s32 offset;		/* in units of the frequency */
+	u32 used;		/* LRU stamp, 0 = free */
+};
+
+/*
+ * statistics sampled by the stats worker: status only while acquiring,
+ * status and AGC at the slower rate once the acquisition time is over
+ */
+#define SI2183_STATS_ACQ_MS	100
+#define SI2183_STATS_SEARCH_MS	200
+
+static int stats_interval = 1000;
+module_param(stats_interval, int, 0644);
+MODULE_PARM_DESC(stats_interval, "statistics sampling interval once locked "
+		"in ms (default: 1000)");
+
+struct si2183_stats {
+	enum fe_delivery_system delivery_system;
+	enum fe_status status;
+	u8 stat_resp;
+	u8 cnr;
+	u8 snr_mul;
+	u8 agc;
+	bool agc_valid;
+	bool ber_valid;
+	u32 ber;	/* errors per 1e8 bits */
+	u16 ucb;	/* uncorrectable packets since the last sample */
+	enum fe_delivery_system detected;	/* T/T2 auto detection */
+	u8 constellation;	/* DVB-C/MCNS status, 0 if unknown */
+	u8 resp[16];		/* last status response, for get_frontend */
+	u8 resp_len;
+	u32 gen;		/* stats_gen when the sample started */
+
+	/* uncorrectable packets and BER, accumulated over all samples */
+	u32 ucb_total;
+	u64 bit_errors;
+	u64 bit_count;
+};
 
 #define SI2183_ARGLEN      30
 struct si2183_cmd {
@@ -69,14 +255,90 @@ struct si2183_dev {
 	void (*RF_switch)(struct i2c_adapter * i2c,u8 rf_in,u8 flag);
 	u8 rf_in;
 	u8 active_fe;
+
+	/* CTS polling: per-opcode latency estimate and poll counters */
+	u16 cmd_est_us[256];
+	bool fw_loading;	/* no estimates from firmware download polls */
+	u64 cmd_count;
+	u64 cmd_polls;
+
+	struct si2183_prop_shadow prop_shadow[SI2183_PROP_SHADOW];
+	int prop_num;
+	u64 prop_skipped;
+
+	/* last statistics sample, written by stats_work */
+	struct delayed_work stats_work;
+	seqlock_t stats_lock;
+	struct si2183_stats stats;
+	bool stats_valid;
+	u32 stats_gen;		/* bumped by every invalidation */
+	struct dvb_frontend *stats_fe;
+
+	/* acquisition timing of the current tune */
+	unsigned long tune_start;
+	unsigned int acq_ms;
+	unsigned int tune_delay;
+	int empty_count;
+
+	/* serialises tuning against the scan engine */
+	struct mutex tune_mutex;
+	struct dentry *debugfs;
+	struct si2183_scan_result scan[SI2183_SCAN_MAX];
+	int scan_num;
+	struct si2183_sweep *sweep;
+	struct si2183_prescan *prescan;
+
+	/* frontends sharing the demod, by fe->id */
+	struct dvb_frontend *fes[2];
+
+	/* DVB-T/T2 auto detection for the current tune */
+	bool tt2_auto;
+	/* DVB-C constellation auto detection for the current tune */
+	bool qam_auto;
+
+	/* tuned-parameter cache, hint in use and key of the current tune */
+	struct si2183_cache_entry cache[SI2183_CACHE_SIZE];
+	u32 cache_clock;
+	struct si2183_cache_entry hint;
+	bool hint_valid;
+	bool hint_skip;
+	struct si2183_cache_entry tuned;
+	bool tuned_stored;
+	/* request as passed in, restored for a fallback retune */
+	enum fe_delivery_system req_delsys;
+	u32 req_symbol_rate;
+	u32 req_bandwidth_hz;
+	bool lpf_narrowed;
+};
+
+/*
+ * Expected execution time of the slower commands, used to seed the
+ * per-opcode estimate the CTS poll loop adapts at run time.
+ */
+static const struct {
+	u8 cmd;
+	u16 us;
+} si2183_cmd_hint[] = {
+	{ 0x01, 5000 },		/* start firmware */
+	{ 0x13, 1000 },		/* power down */
+	{ 0x85, 1000 },		/* DD_RESTART */
 };
 
+#define SI2183_POLL_MIN_US	100
+#define SI2183_POLL_MAX_US	5000
+
 /* execute firmware command */
 static int si2183_cmd_execute(struct i2c_client *client, struct si2183_cmd *cmd)
 {
 	struct si2183_dev *dev = i2c_get_clientdata(client); 
-	int ret;
+	int ret, polls = 0;
 	unsigned long timeout;
+	unsigned int est, delay;
+	ktime_t start;
+	s64 us, busy_us = 0;
+	u8 op = cmd->args[0];
+	/* CTS-only polls carry no opcode of their own */
+	bool adapt = cmd->wlen && !dev->fw_loading;
 	
 	mutex_lock(&dev->i2c_mutex);
 
@@ -95,10 +357,24 @@ static int si2183_cmd_execute(struct i2c_client *client, struct si2183_cmd *cmd)
 	if (cmd->rlen) {
 		/* wait cmd execution terminate */
 		#define TIMEOUT 500
+		start = ktime_get();
 		timeout = jiffies + msecs_to_jiffies(TIMEOUT);
-		while (!time_after(jiffies, timeout)) {
+
+		/*
+		 * Every poll costs two USB control transfers, so sleep through
+		 * most of the expected time first, then back off exponentially.
+		 */
+		est = adapt ? dev->cmd_est_us[op] : 0;
+		delay = est * 3 / 4;
+		if (delay >= SI2183_POLL_MIN_US)
+			usleep_range(delay, delay + delay / 4);
+		delay = clamp_t(unsigned int, est / 4,
+				SI2183_POLL_MIN_US, SI2183_POLL_MAX_US);
+
+		for (;;) {
 			ret = i2c_master_recv(client, cmd->args,
 							      cmd->rlen);
+			polls++;
 			if (ret < 0) {
 				goto err_mutex_unlock;
 			} else if (ret != cmd->rlen) {
@@ -109,11 +385,19 @@ static int si2183_cmd_execute(struct i2c_client *client, struct si2183_cmd *cmd)
 			/* firmware ready? */
 			if ((cmd->args[0] >> 7) & 0x01)
 				break;
+			if (time_after(jiffies, timeout))
+				break;
+
+			busy_us = ktime_us_delta(ktime_get(), start);
+			usleep_range(delay, delay + delay / 4);
+			delay = min_t(unsigned int, delay * 2, SI2183_POLL_MAX_US);
 		}
 
-		dev_dbg(&client->dev, "cmd execution took %d ms\n",
-				jiffies_to_msecs(jiffies) -
-				(jiffies_to_msecs(timeout) - TIMEOUT));
+		us = ktime_us_delta(ktime_get(), start);
+		dev->cmd_polls += polls;
+		dev->cmd_count++;
+		dev_dbg(&client->dev, "cmd %02x execution took %lld us, %d polls\n",
+				op, us, polls);
 
 		/* error bit set? */
 		if ((cmd->args[0] >> 6) & 0x01) {
@@ -125,6 +409,15 @@ static int si2183_cmd_execute(struct i2c_client *client, struct si2183_cmd *cmd)
 			ret = -ETIMEDOUT;
 			goto err_mutex_unlock;
 		}
+
+		/*
+		 * Track the opcode's latency for the next call: shrink the
+		 * estimate if the first poll already saw CTS, otherwise move it
+		 * towards the last time the firmware was seen busy.
+		 */
+		if (adapt)
+			dev->cmd_est_us[op] = polls == 1 ? est / 2 :
+				(3 * est + min_t(s64, busy_us, U16_MAX)) / 4;
 	}
 
 	mutex_unlock(&dev->i2c_mutex);
@@ -135,11 +428,31 @@ err_mutex_unlock:
 	return ret;
 }
 
+static struct si2183_prop_shadow *si2183_find_prop(struct si2183_dev *dev,
+							u16 prop)
+{
+	int i;
+
+	for (i = 0; i < dev->prop_num; i++)
+		if (dev->prop_shadow[i].prop == prop)
+			return &dev->prop_shadow[i];
+	return NULL;
+}
+
 static int si2183_set_prop(struct i2c_client *client, u16 prop, u16 *val)
 {
+	struct si2183_dev *dev = i2c_get_clientdata(client);
+	struct si2183_prop_shadow *shadow;
 	struct si2183_cmd cmd;
 	int ret;
 
+	/* the firmware already holds this value */
+	shadow = si2183_find_prop(dev, prop);
+	if (shadow && shadow->val == *val) {
+		dev->prop_skipped++;
+		return 0;
+	}
+
 	cmd.args[0] = 0x14;
 	cmd.args[1] = 0x00;
 	cmd.args[2] = (u8) prop;
@@ -149,9 +462,27 @@ static int si2183_set_prop(struct i2c_client *client, u16 prop, u16 *val)
 	cmd.wlen = 6;
 	cmd.rlen = 4;
 	ret = si2183_cmd_execute(client, &cmd);
+
+	if (!shadow && !ret && dev->prop_num < SI2183_PROP_SHADOW) {
+		shadow = &dev->prop_shadow[dev->prop_num++];
+		shadow->prop = prop;
+	}
+	if (shadow && ret)
+		/* value unknown after a failed write */
+		*shadow = dev->prop_shadow[--dev->prop_num];
+	else if (shadow)
+		shadow->val = *val;
+
 	*val = (cmd.args[2] | (cmd.args[3] << 8));
 	return ret;
 }
+
+/* forget all shadowed properties, the firmware state is reset */
+static void si2183_flush_props(struct si2183_dev *dev)
+{
+	dev->prop_num = 0;
+}
+
 #if 0
 static int si2183_get_prop(struct i2c_client *client, u16 prop, u16 *val)
 {
@@ -170,127 +501,375 @@ static int si2183_get_prop(struct i2c_client *client, u16 prop, u16 *val)
 }
 #endif
 
-static int si2183_read_status(struct dvb_frontend *fe, enum fe_status *status)
+/* constellation codes of the properties and status responses */
+static enum fe_modulation si2183_qam(u8 code)
+{
+	switch (code) {
+	case 3:
+		return QPSK;
+	case 7:
+		return QAM_16;
+	case 8:
+		return QAM_32;
+	case 9:
+		return QAM_64;
+	case 10:
+		return QAM_128;
+	case 11:
+		return QAM_256;
+	case 14:
+		return PSK_8;
+	case 20:
+		return APSK_16;
+	case 21:
+		return APSK_32;
+	default:
+		return QAM_AUTO;
+	}
+}
+
+/* symbol rates used by J.83 annex B (64 and 256 QAM) */
+static bool si2183_is_mcns_sr(u32 symbol_rate)
+{
+	return abs((int)symbol_rate - SI2183_MCNS_SR_64) < SI2183_MCNS_SR_TOL ||
+		abs((int)symbol_rate - SI2183_MCNS_SR_256) < SI2183_MCNS_SR_TOL;
+}
+
+/*
+ * Firmware returns a [0, 255] mantissa and an exponent, convert to
+ * errors per 10^8: mantissa * 10^(8 - exponent).
+ */
+static u32 si2183_rate(u8 exp, u8 mant)
+{
+	int i, n = 8 - (exp & 0x0f);
+	u32 rate = mant;
+
+	for (i = 0; i < n; i++)
+		rate *= 10;
+	for (i = 0; i > n; i--)
+		rate /= 10;
+	return rate;
+}
+
+/* sample status, AGC, BER and UCB of the running delivery system */
+static int si2183_sample_stats(struct i2c_client *client,
+				struct si2183_stats *st, bool agc)
 {
-	struct i2c_client *client = fe->demodulator_priv;
 	struct si2183_dev *dev = i2c_get_clientdata(client);
-	struct dtv_frontend_properties *c = &fe->dtv_property_cache;
+	struct dvb_frontend *fe = dev->stats_fe;
+	enum fe_delivery_system delsys;
 	int ret;
 	struct si2183_cmd cmd;
-	u16 agc, snr_mul;
 
-	*status = 0;
+	memset(st, 0, sizeof(*st));
+	st->gen = READ_ONCE(dev->stats_gen);
+	st->delivery_system = dev->delivery_system;
+	delsys = st->delivery_system;
 
-	if (!dev->active) {
-		ret = -EAGAIN;
-		goto err;
-	}
+	/* T/T2 auto detection: DD_STATUS tells which standard was found */
+	if (dev->tt2_auto) {
+		memcpy(cmd.args, "\x87\x01", 2);
+		cmd.wlen = 2;
+		cmd.rlen = 8;
+		ret = si2183_cmd_execute(client, &cmd);
+		if (ret)
+			return ret;
 
-	if ((dev->delivery_system != c->delivery_system) || (dev->delivery_system == 0))
-		return 0;
+		switch (cmd.args[3] & 0x0f) {
+		case 2:
+			delsys = SYS_DVBT;
+			break;
+		case 7:
+			delsys = SYS_DVBT2;
+			break;
+		default:
+			/* still searching */
+			st->stat_resp = cmd.args[2];
+			if (st->stat_resp & 0x02)
+				st->status = FE_HAS_SIGNAL | FE_HAS_CARRIER;
+			return 0;
+		}
+		st->detected = delsys;
+	}
 
-	switch (c->delivery_system) {
+	switch (delsys) {
 	case SYS_DVBT:
 		memcpy(cmd.args, "\xa0\x01", 2);
 		cmd.wlen = 2;
 		cmd.rlen = 13;
-		snr_mul = 2;
+		st->snr_mul = 2;
 		break;
 	case SYS_DVBC_ANNEX_A:
 	case SYS_DVBC_ANNEX_C:
 		memcpy(cmd.args, "\x90\x01", 2);
 		cmd.wlen = 2;
 		cmd.rlen = 9;
-		snr_mul = 2;
+		st->snr_mul = 2;
 		break;
 	case SYS_DVBC_ANNEX_B:
 		memcpy(cmd.args, "\x98\x01", 2);
 		cmd.wlen = 2;
 		cmd.rlen = 10;
-		snr_mul = 2;
+		st->snr_mul = 2;
 		break;
 	case SYS_DVBT2:
 		memcpy(cmd.args, "\x50\x01", 2);
 		cmd.wlen = 2;
 		cmd.rlen = 14;
-		snr_mul = 2;
+		st->snr_mul = 2;
 		break;
 	case SYS_DVBS:
 		memcpy(cmd.args, "\x60\x01", 2);
 		cmd.wlen = 2;
 		cmd.rlen = 10;
-		snr_mul = 5;
+		st->snr_mul = 5;
 		break;
 	case SYS_DVBS2:
 		memcpy(cmd.args, "\x70\x01", 2);
 		cmd.wlen = 2;
 		cmd.rlen = 13;
-		snr_mul = 5;
+		st->snr_mul = 5;
 		break;
 	case SYS_ISDBT:
 		memcpy(cmd.args, "\xa4\x01", 2);
 		cmd.wlen = 2;
 		cmd.rlen = 14;
-		snr_mul = 2;
+		st->snr_mul = 2;
 		break;
 /*	case SYS_DVBC2:
 		memcpy(cmd.args, "\x91\x01", 2);
 		cmd.wlen = 2;
 		cmd.rlen = 16;
-		snr_mul = 2;
+		st->snr_mul = 2;
 		break;
 */	default:
-		ret = -EINVAL;
-		goto err;
+		return -EINVAL;
 	}
 
 	ret = si2183_cmd_execute(client, &cmd);
-	if (ret) {
-		dev_err(&client->dev, "read_status fe%d cmd_exec failed=%d\n", fe->id, ret);
-		goto err;
-	}
+	if (ret)
+		return ret;
 
-	dev->stat_resp = cmd.args[2];
-	switch ((dev->stat_resp >> 1) & 0x03) {
+	st->stat_resp = cmd.args[2];
+	st->cnr = cmd.args[3];
+	if (delsys == SYS_DVBC_ANNEX_A || delsys == SYS_DVBC_ANNEX_B ||
+	    delsys == SYS_DVBC_ANNEX_C)
+		st->constellation = cmd.args[8] & 0x3f;
+	st->resp_len = min_t(unsigned int, cmd.rlen, sizeof(st->resp));
+	memcpy(st->resp, cmd.args, st->resp_len);
+	switch ((st->stat_resp >> 1) & 0x03) {
 	case 0x01:
-		*status = FE_HAS_SIGNAL | FE_HAS_CARRIER;
-		c->cnr.len = 1;
-		c->cnr.stat[0].scale = FE_SCALE_NOT_AVAILABLE;
+		st->status = FE_HAS_SIGNAL | FE_HAS_CARRIER;
 		break;
 	case 0x03:
-		*status = FE_HAS_SIGNAL | FE_HAS_CARRIER | FE_HAS_VITERBI |
+		st->status = FE_HAS_SIGNAL | FE_HAS_CARRIER | FE_HAS_VITERBI |
 				FE_HAS_SYNC | FE_HAS_LOCK;
-		c->cnr.len = 2;
-		c->cnr.stat[0].scale = FE_SCALE_DECIBEL;			
-		c->cnr.stat[0].svalue = (s64)cmd.args[3] * 250;
-		c->cnr.stat[1].scale = FE_SCALE_RELATIVE;
-		c->cnr.stat[1].uvalue = (s64)cmd.args[3] * 164 * snr_mul;
-		break;
-	default:
-		c->cnr.len = 1;
-		c->cnr.stat[0].scale = FE_SCALE_NOT_AVAILABLE;
 		break;
 	}
-	
-	dev->fe_status = *status;
 
 	dev_dbg(&client->dev, "status=%02x args=%*ph\n",
-			*status, cmd.rlen, cmd.args);
+			st->status, cmd.rlen, cmd.args);
 
-	if (fe->ops.tuner_ops.get_rf_strength)
-	{
+	if (agc && fe && fe->ops.tuner_ops.get_rf_strength) {
 		memcpy(cmd.args, "\x8a\x00\x00\x00\x00\x00", 6);
 		cmd.wlen = 6;
 		cmd.rlen = 3;
 		ret = si2183_cmd_execute(client, &cmd);
-		if (ret) {
-			dev_err(&client->dev, "read_status fe%d cmd_exec failed=%d\n", fe->id, ret);
-			goto err;
-		}
-		dev_dbg(&client->dev, "status=%02x args=%*ph\n",
-			*status, cmd.rlen, cmd.args);
+		if (ret)
+			return ret;
+		st->agc = cmd.args[1];
+		st->agc_valid = true;
+	}
 
-		agc = cmd.args[1];
+	if (st->status & FE_HAS_LOCK) {
+		/* BER */
+		memcpy(cmd.args, "\x82\x00", 2);
+		cmd.wlen = 2;
+		cmd.rlen = 3;
+		ret = si2183_cmd_execute(client, &cmd);
+		if (ret)
+			return ret;
+		st->ber = si2183_rate(cmd.args[1], cmd.args[2]);
+		st->ber_valid = true;
+	}
+
+	if (st->stat_resp & 0x10) {
+		/* UCB, cleared after reading */
+		memcpy(cmd.args, "\x84\x01", 2);
+		cmd.wlen = 2;
+		cmd.rlen = 3;
+		ret = si2183_cmd_execute(client, &cmd);
+		if (ret)
+			return ret;
+		st->ucb = (u16)cmd.args[2] << 8 | cmd.args[1];
+		/* firmware sometimes returns a bogus value */
+		if (st->ucb == 0xffff)
+			st->ucb = 0;
+	}
+
+	return 0;
+}
+
+static void si2183_publish_stats(struct si2183_dev *dev,
+				struct si2183_stats *st)
+{
+	write_seqlock(&dev->stats_lock);
+	/* started before the last invalidation, may be the previous tune */
+	if (st->gen != dev->stats_gen) {
+		write_sequnlock(&dev->stats_lock);
+		return;
+	}
+	st->ucb_total = dev->stats.ucb_total + st->ucb;
+	/* every BER sample stands for 10^8 bits, as in mainline si2168 */
+	st->bit_errors = dev->stats.bit_errors;
+	st->bit_count = dev->stats.bit_count;
+	if (st->ber_valid) {
+		st->bit_errors += st->ber;
+		st->bit_count += 100000000;
+	}
+	dev->stats = *st;
+	dev->stats_valid = true;
+	write_sequnlock(&dev->stats_lock);
+}
+
+static void si2183_invalidate_stats(struct si2183_dev *dev)
+{
+	write_seqlock(&dev->stats_lock);
+	dev->stats_valid = false;
+	WRITE_ONCE(dev->stats_gen, dev->stats_gen + 1);
+	write_sequnlock(&dev->stats_lock);
+}
+
+static void si2183_stats_work(struct work_struct *work)
+{
+	struct si2183_dev *dev = container_of(to_delayed_work(work),
+					struct si2183_dev, stats_work);
+	struct i2c_client *client = dev->fe.demodulator_priv;
+	struct si2183_stats st;
+	bool acquiring;
+	int ret;
+
+	if (!dev->active || !dev->delivery_system)
+		return;
+
+	acquiring = !(dev->fe_status & FE_HAS_LOCK) &&
+		time_before(jiffies, dev->tune_start +
+			msecs_to_jiffies(dev->acq_ms));
+	ret = si2183_sample_stats(client, &st, !acquiring);
+	if (ret)
+		dev_dbg(&client->dev, "stats sample failed=%d\n", ret);
+	else
+		si2183_publish_stats(dev, &st);
+
+	/* poll fast while acquiring, then settle to the configured cadence */
+	schedule_delayed_work(&dev->stats_work, msecs_to_jiffies(
+			(!ret && (st.status & FE_HAS_LOCK)) ?
+			max(stats_interval, SI2183_STATS_ACQ_MS) :
+			acquiring ? SI2183_STATS_ACQ_MS :
+			SI2183_STATS_SEARCH_MS));
+}
+
+/* the worker has published a sample of the current tune */
+static bool si2183_stats_ready(struct si2183_dev *dev)
+{
+	unsigned int seq;
+	bool ready;
+
+	do {
+		seq = read_seqbegin(&dev->stats_lock);
+		ready = dev->stats_valid &&
+			dev->stats.delivery_system == dev->delivery_system;
+	} while (read_seqretry(&dev->stats_lock, seq));
+	return ready;
+}
+
+/* copy of the last sample, taken inline if the worker has none yet */
+static int si2183_get_stats(struct i2c_client *client,
+				struct si2183_stats *st)
+{
+	struct si2183_dev *dev = i2c_get_clientdata(client);
+	unsigned int seq;
+	bool valid;
+	int ret;
+
+	do {
+		seq = read_seqbegin(&dev->stats_lock);
+		valid = dev->stats_valid;
+		*st = dev->stats;
+	} while (read_seqretry(&dev->stats_lock, seq));
+
+	if (valid && st->delivery_system == dev->delivery_system)
+		return 0;
+
+	ret = si2183_sample_stats(client, st, true);
+	if (!ret)
+		si2183_publish_stats(dev, st);
+	return ret;
+}
+
+static int si2183_read_status(struct dvb_frontend *fe, enum fe_status *status)
+{
+	struct i2c_client *client = fe->demodulator_priv;
+	struct si2183_dev *dev = i2c_get_clientdata(client);
+	struct dtv_frontend_properties *c = &fe->dtv_property_cache;
+	struct si2183_stats st;
+	int ret;
+	u16 agc;
+
+	*status = 0;
+
+	if (!dev->active) {
+		ret = -EAGAIN;
+		goto err;
+	}
+
+	if ((dev->delivery_system != c->delivery_system) || (dev->delivery_system == 0))
+		return 0;
+
+	ret = si2183_get_stats(client, &st);
+	if (ret) {
+		dev_err(&client->dev, "read_status fe%d cmd_exec failed=%d\n", fe->id, ret);
+		goto err;
+	}
+
+	*status = st.status;
+	dev->stat_resp = st.stat_resp;
+
+	/* report the standard the demod detected */
+	if (st.detected && st.detected != c->delivery_system) {
+		dev_dbg(&client->dev, "detected delivery system %u\n",
+				st.detected);
+		c->delivery_system = st.detected;
+		dev->delivery_system = st.detected;
+	}
+	if (dev->qam_auto && (st.status & FE_HAS_LOCK))
+		c->modulation = si2183_qam(st.constellation);
+	if (st.status & FE_HAS_LOCK) {
+		c->cnr.len = 2;
+		c->cnr.stat[0].scale = FE_SCALE_DECIBEL;			
+		c->cnr.stat[0].svalue = (s64)st.cnr * 250;
+		c->cnr.stat[1].scale = FE_SCALE_RELATIVE;
+		c->cnr.stat[1].uvalue = (s64)st.cnr * 164 * st.snr_mul;
+	} else {
+		c->cnr.len = 1;
+		c->cnr.stat[0].scale = FE_SCALE_NOT_AVAILABLE;
+	}
+
+	if (st.bit_count) {
+		c->post_bit_error.stat[0].scale = FE_SCALE_COUNTER;
+		c->post_bit_error.stat[0].uvalue = st.bit_errors;
+		c->post_bit_count.stat[0].scale = FE_SCALE_COUNTER;
+		c->post_bit_count.stat[0].uvalue = st.bit_count;
+	}
+	if (st.status & FE_HAS_LOCK) {
+		c->block_error.stat[0].scale = FE_SCALE_COUNTER;
+		c->block_error.stat[0].uvalue = st.ucb_total;
+	}
+
+	dev->fe_status = *status;
+
+	if (st.agc_valid && fe->ops.tuner_ops.get_rf_strength) {
+		agc = st.agc;
 		fe->ops.tuner_ops.get_rf_strength(fe, &agc);
 	}
 
@@ -333,19 +912,16 @@ static int si2183_read_ber(struct dvb_frontend *fe, u32 *ber)
 {
 	struct i2c_client *client = fe->demodulator_priv;
 	struct si2183_dev *dev = i2c_get_clientdata(client);
-	struct si2183_cmd cmd;
+	struct si2183_stats st;
 	int ret;
 	
 	if (dev->fe_status & FE_HAS_LOCK) {
-		memcpy(cmd.args, "\x82\x00", 2);
-		cmd.wlen = 2;
-		cmd.rlen = 3;
-		ret = si2183_cmd_execute(client, &cmd);
+		ret = si2183_get_stats(client, &st);
 		if (ret) {
 			dev_err(&client->dev, "read_ber fe%d cmd_exec failed=%d\n", fe->id, ret);
 			goto err;
 		}
-		*ber = (u32)cmd.args[2] * cmd.args[1] & 0xf;
+		*ber = st.ber_valid ? st.ber : 1;
 	} else *ber = 1;
 
 	return 0;
@@ -358,21 +934,19 @@ static int si2183_read_ucblocks(struct dvb_frontend *fe, u32 *ucblocks)
 {
 	struct i2c_client *client = fe->demodulator_priv;
 	struct si2183_dev *dev = i2c_get_clientdata(client);
-	struct si2183_cmd cmd;
+	struct si2183_stats st;
 	int ret;
 	
-	if (dev->stat_resp & 0x10) {
-		memcpy(cmd.args, "\x84\x00", 2);
-		cmd.wlen = 2;
-		cmd.rlen = 3;
-		ret = si2183_cmd_execute(client, &cmd);
-		if (ret) {
-		dev_err(&client->dev, "read_ucblocks fe%d cmd_exec failed=%d\n", fe->id, ret);
-			goto err;
-		}
+	*ucblocks = 0;
+	if (!dev->active || !dev->delivery_system)
+		return 0;
 
-		*ucblocks = (u16)cmd.args[2] << 8 | cmd.args[1];
-	} else 	*ucblocks = 0;
+	ret = si2183_get_stats(client, &st);
+	if (ret) {
+		dev_err(&client->dev, "read_ucblocks fe%d cmd_exec failed=%d\n", fe->id, ret);
+		goto err;
+	}
+	*ucblocks = st.ucb_total;
 
 	return 0;
 err:
@@ -380,36 +954,395 @@ err:
 	return ret;
 }
 
-static int si2183_set_dvbc(struct dvb_frontend *fe)
+static enum fe_code_rate si2183_fec(u8 code)
 {
-	struct dtv_frontend_properties *c = &fe->dtv_property_cache;
-	struct i2c_client *client = fe->demodulator_priv;
-	int ret;
-	u16 prop;
+	switch (code) {
+	case 1:
+		return FEC_1_2;
+	case 2:
+		return FEC_2_3;
+	case 3:
+		return FEC_3_4;
+	case 4:
+		return FEC_4_5;
+	case 5:
+		return FEC_5_6;
+	case 6:
+		return FEC_6_7;
+	case 7:
+		return FEC_7_8;
+	case 8:
+		return FEC_8_9;
+	case 9:
+		return FEC_1_4;
+	case 10:
+		return FEC_3_5;
+	case 11:
+		return FEC_9_10;
+	case 12:
+		return FEC_2_5;
+	case 13:
+		return FEC_1_3;
+	default:
+		return FEC_AUTO;
+	}
+}
 
-	/* dvb-c mode */
-	prop = 0x38;
-	ret = si2183_set_prop(client, SI2183_PROP_MODE, &prop);
-	if (ret) {
-		dev_err(&client->dev, "err set dvb-c mode\n");
-		return ret;
+static enum fe_transmit_mode si2183_fft(u8 code)
+{
+	switch (code) {
+	case 10:
+		return TRANSMISSION_MODE_1K;
+	case 11:
+		return TRANSMISSION_MODE_2K;
+	case 12:
+		return TRANSMISSION_MODE_4K;
+	case 13:
+		return TRANSMISSION_MODE_8K;
+	case 14:
+		return TRANSMISSION_MODE_16K;
+	case 15:
+		return TRANSMISSION_MODE_32K;
+	default:
+		return TRANSMISSION_MODE_AUTO;
 	}
+}
 
-	switch (c->modulation) {
+static enum fe_guard_interval si2183_guard(u8 code)
+{
+	switch (code) {
+	case 0:
+		return GUARD_INTERVAL_1_32;
+	case 1:
+		return GUARD_INTERVAL_1_16;
+	case 2:
+		return GUARD_INTERVAL_1_8;
+	case 3:
+		return GUARD_INTERVAL_1_4;
+	case 4:
+		return GUARD_INTERVAL_1_128;
+	case 5:
+		return GUARD_INTERVAL_19_128;
+	case 6:
+		return GUARD_INTERVAL_19_256;
 	default:
-	case QAM_AUTO:
-		prop = 0;
-		break;
-	case QAM_16:
-		prop = 7;
-		break;
-	case QAM_32:
-		prop = 8;
-		break;
-	case QAM_64:
-		prop = 9;
-		break;
-	case QAM_128:
+		return GUARD_INTERVAL_AUTO;
+	}
+}
+
+static enum fe_hierarchy si2183_hierarchy(u8 code)
+{
+	switch (code) {
+	case 1:
+		return HIERARCHY_NONE;
+	case 2:
+		return HIERARCHY_1;
+	case 3:
+		return HIERARCHY_2;
+	case 5:
+		return HIERARCHY_4;
+	default:
+		return HIERARCHY_AUTO;
+	}
+}
+
+static enum fe_rolloff si2183_rolloff(u8 code)
+{
+	switch (code) {
+	case 0:
+		return ROLLOFF_35;
+	case 1:
+		return ROLLOFF_25;
+	case 2:
+		return ROLLOFF_20;
+	case 4:
+		return ROLLOFF_15;
+	case 5:
+		return ROLLOFF_10;
+	case 6:
+		return ROLLOFF_5;
+	default:
+		return ROLLOFF_AUTO;
+	}
+}
+
+/* tracking filter in Hz for a DVB-S/S2 status roll-off code */
+static u32 si2183_track_bw(u32 symbol_rate, u8 code)
+{
+	u32 sr = symbol_rate / 1000;
+	u32 ro, bw;
+
+	switch (si2183_rolloff(code)) {
+	case ROLLOFF_25:
+		ro = 25;
+		break;
+	case ROLLOFF_20:
+		ro = 20;
+		break;
+	case ROLLOFF_15:
+		ro = 15;
+		break;
+	case ROLLOFF_10:
+		ro = 10;
+		break;
+	case ROLLOFF_5:
+		ro = 5;
+		break;
+	default:
+		ro = 35;
+		break;
+	}
+
+	bw = DIV_ROUND_UP(sr * (100 + ro), 200);
+	bw += sr < SI2183_TRACK_SR_LOW ? SI2183_TRACK_MARGIN_LOW :
+		SI2183_TRACK_MARGIN;
+	return bw * 108 / 100 * 1000;
+}
+
+/*
+ * Decode the transmission parameters from the last status response of the
+ * locked delivery system:
+ *   args[8]  constellation [5:0], spectral inversion [6]
+ *   args[9]  DVB-T HP [3:0] / LP [7:4] code rate, DVB-S/S2 code rate [3:0],
+ *            DVB-T2 PLP id
+ *   args[10] FFT mode [3:0], guard interval [6:4] (DVB-T/T2, ISDB-T),
+ *            DVB-S2 roll-off [2:0], pilots [7]
+ *   args[11] DVB-T hierarchy [2:0]
+ *   args[12] DVB-S2 ISI
+ *   args[13] DVB-T2 PLP code rate [3:0]
+ */
+static int si2183_get_frontend(struct dvb_frontend *fe,
+				struct dtv_frontend_properties *c)
+{
+	struct i2c_client *client = fe->demodulator_priv;
+	struct si2183_dev *dev = i2c_get_clientdata(client);
+	struct si2183_stats st;
+	const u8 *r = st.resp;
+	int ret;
+
+	if (!dev->active || !dev->delivery_system ||
+	    dev->delivery_system != c->delivery_system)
+		return 0;
+
+	ret = si2183_get_stats(client, &st);
+	if (ret) {
+		dev_err(&client->dev, "get_frontend failed=%d\n", ret);
+		return ret;
+	}
+	if (!(st.status & FE_HAS_LOCK) || st.resp_len < 9)
+		return 0;
+
+	c->inversion = (r[8] & 0x40) ? INVERSION_ON : INVERSION_OFF;
+	if (c->delivery_system != SYS_ISDBT)
+		c->modulation = si2183_qam(r[8] & 0x3f);
+
+	switch (c->delivery_system) {
+	case SYS_DVBT:
+		c->code_rate_HP = si2183_fec(r[9] & 0x0f);
+		c->code_rate_LP = si2183_fec(r[9] >> 4);
+		c->transmission_mode = si2183_fft(r[10] & 0x0f);
+		c->guard_interval = si2183_guard((r[10] >> 4) & 0x07);
+		c->hierarchy = si2183_hierarchy(r[11] & 0x07);
+		break;
+	case SYS_DVBT2:
+		if (c->stream_id != NO_STREAM_ID_FILTER)
+			c->stream_id = (c->stream_id & ~0xff) | r[9];
+		c->transmission_mode = si2183_fft(r[10] & 0x0f);
+		c->guard_interval = si2183_guard((r[10] >> 4) & 0x07);
+		c->fec_inner = si2183_fec(r[13] & 0x0f);
+		break;
+	case SYS_ISDBT:
+		c->transmission_mode = si2183_fft(r[10] & 0x0f);
+		c->guard_interval = si2183_guard((r[10] >> 4) & 0x07);
+		break;
+	case SYS_DVBS:
+	case SYS_DSS:
+		c->fec_inner = si2183_fec(r[9] & 0x0f);
+		c->rolloff = ROLLOFF_35;
+		c->pilot = PILOT_OFF;
+		break;
+	case SYS_DVBS2:
+		c->fec_inner = si2183_fec(r[9] & 0x0f);
+		c->rolloff = si2183_rolloff(r[10] & 0x07);
+		c->pilot = (r[10] & 0x80) ? PILOT_ON : PILOT_OFF;
+		/* ISI only, the PLS mode and code bits stay as requested */
+		if (c->stream_id != NO_STREAM_ID_FILTER)
+			c->stream_id = (c->stream_id & ~0xff) | r[12];
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static void si2183_cache_key(struct dtv_frontend_properties *c,
+				struct si2183_cache_entry *e)
+{
+	memset(e, 0, sizeof(*e));
+	e->key_delsys = c->delivery_system;
+	e->key_frequency = c->frequency;
+	switch (c->delivery_system) {
+	case SYS_DVBT:
+	case SYS_DVBT2:
+	case SYS_ISDBT:
+		e->key_rate = c->bandwidth_hz;
+		break;
+	default:
+		e->key_rate = c->symbol_rate;
+		break;
+	}
+}
+
+static struct si2183_cache_entry *si2183_cache_find(struct si2183_dev *dev,
+				const struct si2183_cache_entry *key)
+{
+	int i;
+
+	for (i = 0; i < SI2183_CACHE_SIZE; i++) {
+		struct si2183_cache_entry *e = &dev->cache[i];
+
+		if (e->used && e->key_delsys == key->key_delsys &&
+		    e->key_frequency == key->key_frequency &&
+		    e->key_rate == key->key_rate)
+			return e;
+	}
+	return NULL;
+}
+
+/* store the parameters the demod locked on, replacing the oldest entry */
+static void si2183_cache_store(struct si2183_dev *dev,
+				struct dtv_frontend_properties *c,
+				const struct si2183_stats *st)
+{
+	struct si2183_cache_entry *e = si2183_cache_find(dev, &dev->tuned);
+	const u8 *r = st->resp;
+	s32 afc;
+	int i;
+
+	if (st->resp_len < 9)
+		return;
+	if (!e) {
+		e = &dev->cache[0];
+		for (i = 1; i < SI2183_CACHE_SIZE; i++)
+			if (dev->cache[i].used < e->used)
+				e = &dev->cache[i];
+	}
+
+	/* AFC offset in kHz, left over after the tune */
+	afc = (s16)(r[4] | r[5] << 8);
+	switch (c->delivery_system) {
+	case SYS_DVBS:
+	case SYS_DVBS2:
+	case SYS_DSS:
+		break;
+	default:
+		afc *= 1000;
+		break;
+	}
+	/* a cached tune was already moved by the hinted offset */
+	if (dev->hint_valid)
+		afc += dev->hint.offset;
+
+	*e = dev->tuned;
+	e->delivery_system = c->delivery_system;
+	e->symbol_rate = c->symbol_rate;
+	e->modulation = si2183_qam(r[8] & 0x3f);
+	e->inversion = (r[8] & 0x40) ? INVERSION_ON : INVERSION_OFF;
+	e->offset = afc;
+	e->used = ++dev->cache_clock;
+}
+
+static int si2183_set_afc(struct dvb_frontend *fe)
+{
+	struct dtv_frontend_properties *c = &fe->dtv_property_cache;
+	struct i2c_client *client = fe->demodulator_priv;
+	struct si2183_dev *dev = i2c_get_clientdata(client);
+	bool narrow = dev->hint_valid;
+	u16 prop, afc;
+	int ret;
+
+	switch (c->delivery_system) {
+	case SYS_DVBC_ANNEX_A:
+	case SYS_DVBC_ANNEX_C:
+		prop = SI2183_PROP_DVBC_AFC;
+		afc = narrow ? SI2183_AFC_NARROW_TC : SI2183_AFC_C;
+		break;
+	case SYS_DVBC_ANNEX_B:
+		prop = SI2183_PROP_MCNS_AFC;
+		afc = narrow ? SI2183_AFC_NARROW_TC : SI2183_AFC_MCNS;
+		break;
+	case SYS_DVBT:
+		prop = SI2183_PROP_DVBT_AFC;
+		afc = narrow ? SI2183_AFC_NARROW_TC : SI2183_AFC_T;
+		break;
+	case SYS_DVBT2:
+		prop = SI2183_PROP_DVBT2_AFC;
+		afc = narrow ? SI2183_AFC_NARROW_TC : SI2183_AFC_T;
+		break;
+	case SYS_DVBS:
+	case SYS_DSS:
+		prop = SI2183_PROP_DVBS_AFC;
+		afc = narrow ? SI2183_AFC_NARROW_S : SI2183_AFC_S;
+		break;
+	case SYS_DVBS2:
+		prop = SI2183_PROP_DVBS2_AFC;
+		afc = narrow ? SI2183_AFC_NARROW_S : SI2183_AFC_S;
+		break;
+	default:
+		return 0;
+	}
+
+	/*
+	 * Without a hint only cable gets its range programmed, as always;
+	 * T and S keep the firmware default and are only put back to it
+	 * after a narrowed tune changed it.
+	 */
+	if (!narrow && prop != SI2183_PROP_DVBC_AFC &&
+	    prop != SI2183_PROP_MCNS_AFC && !si2183_find_prop(dev, prop))
+		return 0;
+
+	ret = si2183_set_prop(client, prop, &afc);
+	if (ret)
+		dev_err(&client->dev, "err set AFC range\n");
+	return ret;
+}
+
+static int si2183_set_dvbc(struct dvb_frontend *fe)
+{
+	struct dtv_frontend_properties *c = &fe->dtv_property_cache;
+	struct i2c_client *client = fe->demodulator_priv;
+	struct si2183_dev *dev = i2c_get_clientdata(client);
+	enum fe_modulation modulation;
+	int ret;
+	u16 prop;
+
+	/* dvb-c mode */
+	prop = 0x38;
+	ret = si2183_set_prop(client, SI2183_PROP_MODE, &prop);
+	if (ret) {
+		dev_err(&client->dev, "err set dvb-c mode\n");
+		return ret;
+	}
+
+	modulation = c->modulation;
+	if (modulation == QAM_AUTO && dev->hint_valid)
+		modulation = dev->hint.modulation;
+	switch (modulation) {
+	default:
+	case QAM_AUTO:
+		prop = 0;
+		break;
+	case QAM_16:
+		prop = 7;
+		break;
+	case QAM_32:
+		prop = 8;
+		break;
+	case QAM_64:
+		prop = 9;
+		break;
+	case QAM_128:
 		prop = 10;
 		break;
 	case QAM_256:
@@ -430,14 +1363,6 @@ static int si2183_set_dvbc(struct dvb_frontend *fe)
 		return ret;
 	}
 
-	/* AFC range */
-	prop = 100;
-	ret = si2183_set_prop(client, SI2183_PROP_DVBC_AFC, &prop);
-	if (ret) {
-		dev_err(&client->dev, "err set dvb-c AFC range\n");
-		return ret;
-	}
-
 	return 0;
 }
 
@@ -445,6 +1370,8 @@ static int si2183_set_mcns(struct dvb_frontend *fe)
 {
 	struct dtv_frontend_properties *c = &fe->dtv_property_cache;
 	struct i2c_client *client = fe->demodulator_priv;
+	struct si2183_dev *dev = i2c_get_clientdata(client);
+	enum fe_modulation modulation;
 	int ret;
 	u16 prop;
 
@@ -456,7 +1383,10 @@ static int si2183_set_mcns(struct dvb_frontend *fe)
 		return ret;
 	}
 
-	switch (c->modulation) {
+	modulation = c->modulation;
+	if (modulation == QAM_AUTO && dev->hint_valid)
+		modulation = dev->hint.modulation;
+	switch (modulation) {
 	default:
 	case QAM_AUTO:
 		prop = 0;
@@ -491,14 +1421,6 @@ static int si2183_set_mcns(struct dvb_frontend *fe)
 		return ret;
 	}
 
-	/* AFC range */
-	prop = 200;
-	ret = si2183_set_prop(client, SI2183_PROP_MCNS_AFC, &prop);
-	if (ret) {
-		dev_err(&client->dev, "err set mcns AFC range\n");
-		return ret;
-	}
-
 	return 0;
 }
 /*
@@ -527,26 +1449,56 @@ static int si2183_set_dvbc2(struct dvb_frontend *fe)
 	return 0;
 }
 */
-static int gold_code_index (int gold_sequence_index)
+#define SI2183_GOLD_BITS	18
+
+/* m[i] is the image of bit i, returns m * v over GF(2) */
+static u32 si2183_gf2_mul(const u32 *m, u32 v)
+{
+	u32 r = 0;
+	int i;
+
+	for (i = 0; i < SI2183_GOLD_BITS; i++)
+		if (v & (1 << i))
+			r ^= m[i];
+	return r;
+}
+
+/*
+ * Initial state of the gold sequence x register for a DVB-S2 scrambling
+ * index: the LFSR stepped index times from 1, computed as the step matrix
+ * raised to the index by square and multiply.
+ */
+static int gold_code_index(int gold_sequence_index)
 {
-	unsigned int i, k , x_init;
-	u8 GOLD_PRBS[19] = {1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-	for (k=0; k<gold_sequence_index; k++) {
-		GOLD_PRBS[18] = (GOLD_PRBS[0] + GOLD_PRBS[7])%2;
-		/* Shifting 18 first values */
-		for (i=0; i<18; i++) 
-			GOLD_PRBS[i] = GOLD_PRBS[i+1];
+	u32 m[SI2183_GOLD_BITS], sq[SI2183_GOLD_BITS];
+	u32 n = gold_sequence_index, x = 1;
+	int i;
+
+	/* one step: shift right, x17 = x0 ^ x7 */
+	for (i = 0; i < SI2183_GOLD_BITS; i++)
+		m[i] = i ? 1 << (i - 1) : 0;
+	m[0] |= 1 << 17;
+	m[7] |= 1 << 17;
+
+	while (n) {
+		if (n & 1)
+			x = si2183_gf2_mul(m, x);
+		n >>= 1;
+		if (!n)
+			break;
+		for (i = 0; i < SI2183_GOLD_BITS; i++)
+			sq[i] = si2183_gf2_mul(m, m[i]);
+		memcpy(m, sq, sizeof(m));
 	}
-	x_init = 0;
-	for (i=0; i<18; i++) { x_init = x_init + GOLD_PRBS[i]*(1<<i); }
 
-	return x_init;
+	return x;
 }
 
 static int si2183_set_dvbs(struct dvb_frontend *fe)
 {
 	struct dtv_frontend_properties *c = &fe->dtv_property_cache;
 	struct i2c_client *client = fe->demodulator_priv;
+	struct si2183_dev *dev = i2c_get_clientdata(client);
 	struct si2183_cmd cmd;
 	int ret;
 	u16 prop;
@@ -566,8 +1518,12 @@ static int si2183_set_dvbs(struct dvb_frontend *fe)
 		prop |= 0xa0;
 		break;
 	}
-	if (c->inversion)
+	if (c->inversion == INVERSION_AUTO && dev->hint_valid) {
+		if (dev->hint.inversion == INVERSION_ON)
+			prop |= 0x100;
+	} else if (c->inversion) {
 		prop |= 0x100;
+	}
 	ret = si2183_set_prop(client, SI2183_PROP_MODE, &prop);
 	if (ret) {
 		dev_err(&client->dev, "err set dvb-s/s2 mode\n");
@@ -660,6 +1616,9 @@ static int si2183_set_dvbt(struct dvb_frontend *fe)
 		prop |= 0x70;
 		break;
 	}
+	/* auto detect, T/T2 */
+	if (dvbt_auto)
+		prop = (prop & 0x0f) | 0xf0 | 0x0200;
 	ret = si2183_set_prop(client, SI2183_PROP_MODE, &prop);
 	if (ret) {
 		dev_err(&client->dev, "err set dvb-t mode\n");
@@ -672,7 +1631,7 @@ static int si2183_set_dvbt(struct dvb_frontend *fe)
 	if (ret)
 		dev_warn(&client->dev, "dvb-t: err set hierarchy\n");
 
-	if (c->delivery_system == SYS_DVBT2) {
+	if (c->delivery_system == SYS_DVBT2 || dvbt_auto) {
 		/* stream_id selection */
 		cmd.args[0] = 0x52;
 		cmd.args[1] = (u8) c->stream_id;
@@ -729,6 +1688,8 @@ static int si2183_set_isdbt(struct dvb_frontend *fe)
 	return 0;
 }
 
+static int si2183_dvbc_detect(struct dvb_frontend *fe);
+
 static int si2183_set_frontend(struct dvb_frontend *fe)
 {
 	struct i2c_client *client = fe->demodulator_priv;
@@ -736,6 +1697,7 @@ static int si2183_set_frontend(struct dvb_frontend *fe)
 	struct dtv_frontend_properties *c = &fe->dtv_property_cache;
 	int ret;
 	struct si2183_cmd cmd;
+	bool dvbc_detect;
 
 	dev_dbg(&client->dev,
 			"delivery_system=%u modulation=%u frequency=%u bandwidth_hz=%u symbol_rate=%u inversion=%u stream_id=%u\n",
@@ -748,11 +1710,49 @@ static int si2183_set_frontend(struct dvb_frontend *fe)
 		goto err;
 	}
 
+	/* drop statistics of the previous channel */
+	si2183_invalidate_stats(dev);
+
+	if (!dev->hint_skip) {
+		dev->req_delsys = c->delivery_system;
+		dev->req_symbol_rate = c->symbol_rate;
+		dev->req_bandwidth_hz = c->bandwidth_hz;
+	}
+
+	dvbc_detect = dvbc_auto && c->symbol_rate == SI2183_DVBC_SR_DETECT &&
+		(c->delivery_system == SYS_DVBC_ANNEX_A ||
+		 c->delivery_system == SYS_DVBC_ANNEX_B);
+
 	/* Force DVB-C Annex B if SR < 6000 Ks */
-	if (c->delivery_system == SYS_DVBC_ANNEX_A && c->symbol_rate < 6000000) {
+	if (!dvbc_detect && c->delivery_system == SYS_DVBC_ANNEX_A &&
+	    c->symbol_rate < 6000000) {
 		c->delivery_system = SYS_DVBC_ANNEX_B;
 		c->bandwidth_hz = 6000000;
 	}
+
+	/* start from the last acquisition of this channel, if any */
+	si2183_cache_key(c, &dev->tuned);
+	dev->tuned_stored = false;
+	dev->hint_valid = false;
+	if (tune_cache && !dev->hint_skip) {
+		struct si2183_cache_entry *e = si2183_cache_find(dev,
+				&dev->tuned);
+
+		if (e) {
+			dev->hint = *e;
+			dev->hint_valid = true;
+			e->used = ++dev->cache_clock;
+			dev_dbg(&client->dev, "cached: offset=%d modulation=%u\n",
+					e->offset, e->modulation);
+		}
+	}
+	dev->hint_skip = false;
+	if (dev->hint_valid && dvbc_detect) {
+		c->delivery_system = dev->hint.delivery_system;
+		c->symbol_rate = dev->hint.symbol_rate;
+		c->bandwidth_hz = c->delivery_system == SYS_DVBC_ANNEX_B ?
+			6000000 : 8000000;
+	}
 /*
 	if(dev->RF_switch)
 	{	
@@ -778,13 +1778,30 @@ static int si2183_set_frontend(struct dvb_frontend *fe)
 	}
 */	
 	if (fe->ops.tuner_ops.set_params) {
+		/* center the carrier found last time */
+		if (dev->hint_valid)
+			c->frequency += dev->hint.offset;
 		ret = fe->ops.tuner_ops.set_params(fe);
+		if (dev->hint_valid)
+			c->frequency -= dev->hint.offset;
 		if (ret) {
 			dev_err(&client->dev, "err setting tuner params\n");
 			goto err;
 		}
 	}
 
+	if (dvbc_detect && !dev->hint_valid) {
+		ret = si2183_dvbc_detect(fe);
+		if (ret)
+			dev_dbg(&client->dev, "dvb-c detection failed=%d\n",
+					ret);
+	}
+	/* report the constellation the demod found */
+	dev->qam_auto = c->modulation == QAM_AUTO &&
+		(c->delivery_system == SYS_DVBC_ANNEX_A ||
+		 c->delivery_system == SYS_DVBC_ANNEX_B ||
+		 c->delivery_system == SYS_DVBC_ANNEX_C);
+
 	switch (c->delivery_system) {
 	case SYS_DVBT:
 	case SYS_DVBT2:
@@ -813,6 +1830,10 @@ static int si2183_set_frontend(struct dvb_frontend *fe)
 		goto err;
 	}
 
+	ret = si2183_set_afc(fe);
+	if (ret)
+		goto err;
+
 	/* dsp restart */
 	memcpy(cmd.args, "\x85", 1);
 	cmd.wlen = 1;
@@ -824,17 +1845,65 @@ static int si2183_set_frontend(struct dvb_frontend *fe)
 	}
 
 	dev->delivery_system = c->delivery_system;
+	dev->tt2_auto = dvbt_auto && (c->delivery_system == SYS_DVBT ||
+				c->delivery_system == SYS_DVBT2);
+	dev->stats_fe = fe;
+	/* drop samples the worker took while the demod was being set up */
+	si2183_invalidate_stats(dev);
+	mod_delayed_work(system_wq, &dev->stats_work,
+			msecs_to_jiffies(SI2183_STATS_ACQ_MS));
 	return 0;
 err:
 	dev_err(&client->dev, "set_params failed=%d\n", ret);
 	return ret;
 }
 
+/*
+ * Send the image record by record; the command protocol wants CTS before
+ * every command, so each record waits for it.
+ */
+static int si2183_download_fw(struct i2c_client *client,
+		const struct firmware *fw)
+{
+	struct si2183_dev *dev = i2c_get_clientdata(client);
+	struct si2183_cmd cmd;
+	size_t pos;
+	int len, ret = 0;
+	ktime_t start = ktime_get();
+	unsigned int ms;
+
+	dev->fw_loading = true;
+	for (pos = 0; pos < fw->size; pos += SI2183_FW_RECLEN) {
+		len = fw->data[pos];
+		if (len > SI2183_ARGLEN || pos + 1 + len > fw->size) {
+			ret = -EINVAL;
+			break;
+		}
+		memcpy(cmd.args, &fw->data[pos + 1], len);
+		cmd.wlen = len;
+		cmd.rlen = 1;
+		ret = si2183_cmd_execute(client, &cmd);
+		if (ret)
+			break;
+	}
+	dev->fw_loading = false;
+	if (ret)
+		return ret;
+
+	ms = ktime_ms_delta(ktime_get(), start);
+	dev_info(&client->dev,
+			"firmware downloaded in %u ms (%zu bytes, %zu KiB/s)\n",
+			ms, fw->size,
+			ms ? fw->size * 1000 / 1024 / ms : 0);
+	return 0;
+}
+
 static int si2183_init(struct dvb_frontend *fe)
 {
 	struct i2c_client *client = fe->demodulator_priv;
 	struct si2183_dev *dev = i2c_get_clientdata(client);
-	int ret = 0, len, remaining;
+	struct dtv_frontend_properties *c = &fe->dtv_property_cache;
+	int ret = 0;
 	const struct firmware *fw;
 	const char *fw_name;
 	struct si2183_cmd cmd;
@@ -843,11 +1912,33 @@ static int si2183_init(struct dvb_frontend *fe)
 
 	dev_dbg(&client->dev, "\n");
 
+	if (fe->id < ARRAY_SIZE(dev->fes))
+		dev->fes[fe->id] = fe;
+
+	/*
+	 * DVBv5 stats, filled by read_status: CNR, post-BER counters grown
+	 * from each DD_BER sample and the uncorrectable block count. The
+	 * firmware has no total block count.
+	 */
+	c->cnr.len = 1;
+	c->cnr.stat[0].scale = FE_SCALE_NOT_AVAILABLE;
+	c->post_bit_error.len = 1;
+	c->post_bit_error.stat[0].scale = FE_SCALE_NOT_AVAILABLE;
+	c->post_bit_count.len = 1;
+	c->post_bit_count.stat[0].scale = FE_SCALE_NOT_AVAILABLE;
+	c->block_error.len = 1;
+	c->block_error.stat[0].scale = FE_SCALE_NOT_AVAILABLE;
+	c->block_count.len = 1;
+	c->block_count.stat[0].scale = FE_SCALE_NOT_AVAILABLE;
+
 	if (dev->active_fe) {
 		dev->active_fe |= (1 << fe->id);
 		return 0;
 	}
 
+	si2183_flush_props(dev);
+	memset(&dev->stats, 0, sizeof(dev->stats));
+
 	/* initialize */
 	memcpy(cmd.args, "\xc0\x12\x00\x0c\x00\x0d\x16\x00\x00\x00\x00\x00\x00", 13);
 	if (dev->start_clk_mode) {
@@ -929,19 +2020,7 @@ static int si2183_init(struct dvb_frontend *fe)
 	dev_info(&client->dev, "downloading firmware from file '%s'\n",
 			fw_name);
 
-	for (remaining = fw->size; remaining > 0; remaining -= 17) {
-		len = fw->data[fw->size - remaining];
-		if (len > SI2183_ARGLEN) {
-			ret = -EINVAL;
-			break;
-		}
-		memcpy(cmd.args, &fw->data[(fw->size - remaining) + 1], len);
-		cmd.wlen = len;
-		cmd.rlen = 1;
-		ret = si2183_cmd_execute(client, &cmd);
-		if (ret)
-			break;
-	}
+	ret = si2183_download_fw(client, fw);
 	release_firmware(fw);
 
 	if (ret) {
@@ -1073,157 +2152,983 @@ static int si2183_init(struct dvb_frontend *fe)
 	if (ret) {
 		dev_err(&client->dev, "err set int sense\n");
 		return ret;
-	}
-
-	/* Control of SQI computation */
-	prop = 0x1e;
-	ret = si2183_set_prop(client, 0x100f, &prop);
-	if (ret) {
-		dev_err(&client->dev, "err set sqi comp\n");
+	}
+
+	/* Control of SQI computation */
+	prop = 0x1e;
+	ret = si2183_set_prop(client, 0x100f, &prop);
+	if (ret) {
+		dev_err(&client->dev, "err set sqi comp\n");
+		return ret;
+	}
+
+	/* Transport Stream setting for parallel mode */
+	prop = 0x0104 | (dev->ts_clock_inv ? 0x0000 : 0x1000);
+	ret = si2183_set_prop(client, 0x1009, &prop);
+	if (ret) {
+		dev_err(&client->dev, "err set par_ts\n");
+		return ret;
+	}
+
+	/* Transport Stream setting for serial mode */
+	prop = 0x230C | (dev->ts_clock_inv ? 0x0000 : 0x1000);
+	ret = si2183_set_prop(client, 0x1008, &prop);
+	if (ret) {
+		dev_err(&client->dev, "err set ser_ts\n");
+		return ret;
+	}
+
+	/* Transport Stream setting for parallel mode - secondary*/
+	prop = 0x08e3;
+	ret = si2183_set_prop(client, 0x1015, &prop);
+	if (ret) {
+		dev_err(&client->dev, "err set int par_ts_sec\n");
+		return ret;
+	}
+
+	/* Transport Stream setting for serial mode - secondary*/
+	prop = 0x01c7;
+	ret = si2183_set_prop(client, 0x1016, &prop);
+	if (ret) {
+		dev_err(&client->dev, "err set int ser_ts_sec\n");
+		return ret;
+	}
+
+	dev->fw_loaded = true;
+warm:
+	dev->active = true;
+	dev->active_fe |= (1 << fe->id);
+	return 0;
+
+err:
+	dev_dbg(&client->dev, "init failed=%d\n", ret);
+	return ret;
+}
+
+static int si2183_sleep(struct dvb_frontend *fe)
+{
+	struct i2c_client *client = fe->demodulator_priv;
+	struct si2183_dev *dev = i2c_get_clientdata(client);
+	int ret;
+	struct si2183_cmd cmd;
+
+	dev_dbg(&client->dev, "\n");
+
+	dev->active_fe &= ~(1 << fe->id);
+	if (dev->active_fe)
+		return 0;
+
+	dev->active = false;
+	si2183_flush_props(dev);
+	cancel_delayed_work_sync(&dev->stats_work);
+	si2183_invalidate_stats(dev);
+
+	dev_dbg(&client->dev,"si2183_sleep\n");
+	memcpy(cmd.args, "\x13", 1);
+	cmd.wlen = 1;
+	cmd.rlen = 0;
+	ret = si2183_cmd_execute(client, &cmd);
+	if (ret)
+		goto err;
+
+	return 0;
+err:
+	dev_dbg(&client->dev, "failed=%d\n", ret);
+	return ret;
+}
+
+/*
+ * Expected acquisition time: satellite and cable scale with the number of
+ * symbols the demod needs to lock, terrestrial with the frame length.
+ */
+static unsigned int si2183_acq_time_ms(struct dtv_frontend_properties *c)
+{
+	u32 sr = max_t(u32, c->symbol_rate, 1000000);
+
+	switch (c->delivery_system) {
+	case SYS_DVBS:
+	case SYS_DVBS2:
+	case SYS_DSS:
+		/* ~2M symbols for timing, carrier and FEC lock */
+		return 50 + 2000000000U / (sr / 1000) / 1000;
+	case SYS_DVBC_ANNEX_A:
+	case SYS_DVBC_ANNEX_B:
+	case SYS_DVBC_ANNEX_C:
+		return 100 + 1000000000U / (sr / 1000) / 1000;
+	case SYS_DVBT:
+		return 300;
+	case SYS_ISDBT:
+		return 400;
+	case SYS_DVBT2:
+	default:
+		/* L1 signalling needs up to two 250 ms T2 frames */
+		return 600;
+	}
+}
+
+static bool si2183_channel_empty(struct si2183_dev *dev,
+				struct dvb_frontend *fe, enum fe_status status)
+{
+	struct dtv_frontend_properties *c = &fe->dtv_property_cache;
+	bool no_rf = false;
+	int i;
+
+	if (dev->stat_resp & SI2183_STAT_NOTSTD)
+		return true;
+	if (status & FE_HAS_SIGNAL)
+		return false;
+
+	/* not before the channel could have been acquired */
+	if (time_before(jiffies, dev->tune_start + msecs_to_jiffies(
+			max_t(unsigned int, dev->acq_ms, SI2183_EMPTY_MIN_MS))))
+		return false;
+	/* only a measured level below the threshold counts as no RF */
+	for (i = 0; i < c->strength.len; i++)
+		if (c->strength.stat[i].scale == FE_SCALE_DECIBEL)
+			no_rf = c->strength.stat[i].svalue < SI2183_NO_RF_MDB;
+	return no_rf;
+}
+
+static int si2183_select(struct i2c_mux_core *muxc, u32 chan)
+{
+	struct i2c_client *client = i2c_mux_priv(muxc);
+	int ret;
+	struct si2183_cmd cmd;
+
+	/* open I2C gate */
+	memcpy(cmd.args, "\xc0\x0d\x01", 3);
+	cmd.wlen = 3;
+	cmd.rlen = 0;
+	ret = i2c_master_send(client, cmd.args, cmd.wlen);
+	if (ret != cmd.wlen)
+		ret = -EREMOTEIO;
+	if (ret)
+		goto err;
+
+	return 0;
+err:
+	dev_dbg(&client->dev, "failed=%d\n", ret);
+	return ret;
+}
+
+static int si2183_deselect(struct i2c_mux_core *muxc, u32 chan)
+{
+	struct i2c_client *client = i2c_mux_priv(muxc);
+	int ret;
+	struct si2183_cmd cmd;
+
+	/* close I2C gate */
+	memcpy(cmd.args, "\xc0\x0d\x00", 3);
+	cmd.wlen = 3;
+	cmd.rlen = 0;
+	ret = i2c_master_send(client, cmd.args, cmd.wlen);
+	if (ret != cmd.wlen)
+		ret = -EREMOTEIO;
+	if (ret)
+		goto err;
+
+	return 0;
+err:
+	dev_dbg(&client->dev, "failed=%d\n", ret);
+	return ret;
+}
+
+/*
+ * Poll fast from set_frontend until lock or the expected acquisition time
+ * has passed, then back off towards one second while locked.
+ */
+static int si2183_tune(struct dvb_frontend *fe, bool re_tune,
+	unsigned int mode_flags, unsigned int *delay, enum fe_status *status)
+{
+	struct i2c_client *client = fe->demodulator_priv;
+	struct si2183_dev *dev = i2c_get_clientdata(client);
+	int ret;
+
+	if (re_tune) {
+		mutex_lock(&dev->tune_mutex);
+		ret = si2183_set_frontend(fe);
+		mutex_unlock(&dev->tune_mutex);
+		if (ret)
+			return ret;
+		dev->tune_start = jiffies;
+		dev->acq_ms = si2183_acq_time_ms(&fe->dtv_property_cache);
+		dev->tune_delay = SI2183_TUNE_FAST;
+		dev->empty_count = 0;
+		dev->lpf_narrowed = false;
+		dev->fe_status = 0;
+	}
+
+	/*
+	 * While acquiring, the fast polls only look at the worker's snapshot
+	 * and send no command of their own; until the worker's first sample
+	 * of this tune there is nothing to report yet.
+	 */
+	if (!(dev->fe_status & FE_HAS_LOCK) && dev->delivery_system &&
+	    !si2183_stats_ready(dev)) {
+		*status = 0;
+		*delay = dev->tune_delay;
+		return 0;
+	}
+
+	ret = si2183_read_status(fe, status);
+	if (ret)
+		return ret;
+
+	/*
+	 * Once locked, move the tuner to its tracking filter for the
+	 * acquired roll-off, narrowing a wide acquisition filter.
+	 */
+	if ((*status & FE_HAS_LOCK) && !dev->lpf_narrowed) {
+		struct dvb_tuner_ops *tuner = &fe->ops.tuner_ops;
+		struct dtv_frontend_properties *c = &fe->dtv_property_cache;
+		struct si2183_stats st;
+
+		dev->lpf_narrowed = true;
+		if ((c->delivery_system == SYS_DVBS ||
+		     c->delivery_system == SYS_DVBS2 ||
+		     c->delivery_system == SYS_DSS) &&
+		    tuner->set_bandwidth &&
+		    !si2183_get_stats(client, &st) && st.resp_len >= 11)
+			tuner->set_bandwidth(fe, si2183_track_bw(c->symbol_rate,
+				c->delivery_system == SYS_DVBS2 ?
+				st.resp[10] & 0x07 : 0));
+	}
+
+	if ((*status & FE_HAS_LOCK) && !dev->tuned_stored && tune_cache) {
+		struct si2183_stats st;
+
+		if (!si2183_get_stats(client, &st)) {
+			si2183_cache_store(dev, &fe->dtv_property_cache, &st);
+			dev->tuned_stored = true;
+		}
+	}
+
+	/* cached parameters did not lock in time, search the full range */
+	if (dev->hint_valid && !(*status & FE_HAS_LOCK) &&
+	    time_after(jiffies, dev->tune_start +
+			msecs_to_jiffies(dev->acq_ms))) {
+		struct dtv_frontend_properties *c = &fe->dtv_property_cache;
+
+		dev_dbg(&client->dev, "cached parameters failed\n");
+		mutex_lock(&dev->tune_mutex);
+		/* the hint may have changed the request, search for it again */
+		c->delivery_system = dev->req_delsys;
+		c->symbol_rate = dev->req_symbol_rate;
+		c->bandwidth_hz = dev->req_bandwidth_hz;
+		dev->hint_skip = true;
+		ret = si2183_set_frontend(fe);
+		mutex_unlock(&dev->tune_mutex);
+		if (ret)
+			return ret;
+		dev->tune_start = jiffies;
+		dev->tune_delay = SI2183_TUNE_FAST;
+		dev->empty_count = 0;
+		dev->lpf_narrowed = false;
+		dev->fe_status = 0;
+		*delay = dev->tune_delay;
+		return 0;
+	}
+
+	/* a few polls in a row that found nothing end the search early */
+	if (!(*status & FE_HAS_LOCK) && si2183_channel_empty(dev, fe, *status))
+		dev->empty_count++;
+	else
+		dev->empty_count = 0;
+	if (empty_polls > 0 && dev->empty_count >= empty_polls) {
+		*status |= FE_TIMEDOUT;
+		*delay = HZ / 5;
+		return 0;
+	}
+
+	if (*status & FE_HAS_LOCK) {
+		dev->tune_delay = min_t(unsigned int, dev->tune_delay * 2, HZ);
+	} else {
+		dev->tune_delay = SI2183_TUNE_FAST;
+		if (time_after(jiffies, dev->tune_start +
+				msecs_to_jiffies(dev->acq_ms)))
+			dev->tune_delay = HZ / 5;
+	}
+	*delay = dev->tune_delay;
+	return 0;
+}
+
+static enum dvbfe_algo si2183_get_algo(struct dvb_frontend *fe)
+{
+	return DVBFE_ALGO_HW;
+}
+
+/*
+ * Take the demod away from normal tuning for a scan or sweep, called with
+ * tune_mutex held. The next tune reprograms it from scratch.
+ */
+static int si2183_takeover(struct si2183_dev *dev, struct dvb_frontend *fe)
+{
+	/* LNB power and band are set through the open frontend */
+	if (!dev->active || !(dev->active_fe & (1 << fe->id)))
+		return -EAGAIN;
+
+	dev->delivery_system = 0;
+	cancel_delayed_work_sync(&dev->stats_work);
+	si2183_invalidate_stats(dev);
+	return 0;
+}
+
+static int si2183_scan_ctrl(struct i2c_client *client, u8 action, u32 freq)
+{
+	struct si2183_cmd cmd;
+
+	cmd.args[0] = 0x31;
+	cmd.args[1] = action;
+	cmd.args[2] = 0;
+	cmd.args[3] = 0;
+	cmd.args[4] = (u8) freq;
+	cmd.args[5] = (u8) (freq >> 8);
+	cmd.args[6] = (u8) (freq >> 16);
+	cmd.args[7] = (u8) (freq >> 24);
+	cmd.wlen = 8;
+	cmd.rlen = 1;
+	return si2183_cmd_execute(client, &cmd);
+}
+
+/*
+ * Tune only the tuner for a scan engine request, satellite with the
+ * widest filter (kHz), cable at 8 MHz (Hz).
+ */
+static int si2183_scan_tune(struct dvb_frontend *fe, bool sat, u32 freq)
+{
+	struct dtv_frontend_properties *c = &fe->dtv_property_cache;
+	struct dtv_frontend_properties save = *c;
+	int ret;
+
+	if (!fe->ops.tuner_ops.set_params)
+		return -ENODEV;
+
+	c->frequency = freq;
+	if (sat) {
+		c->symbol_rate = si2183_ops.info.symbol_rate_max;
+	} else {
+		c->delivery_system = SYS_DVBC_ANNEX_A;
+		c->bandwidth_hz = 8000000;
+	}
+	ret = fe->ops.tuner_ops.set_params(fe);
+	c->frequency = save.frequency;
+	c->symbol_rate = save.symbol_rate;
+	c->delivery_system = save.delivery_system;
+	c->bandwidth_hz = save.bandwidth_hz;
+	return ret;
+}
+
+/*
+ * Run the started scan engine to the next carrier: 1 and *res filled when
+ * one is found, 0 at the end of the range. Frequencies are kHz.
+ */
+static int si2183_scan_next(struct i2c_client *client, struct dvb_frontend *fe,
+				bool sat, struct si2183_scan_result *res)
+{
+	struct si2183_cmd cmd;
+	unsigned long timeout;
+	u32 freq;
+	int ret;
+
+	timeout = jiffies + msecs_to_jiffies(SI2183_SCAN_TIMEOUT);
+	for (;;) {
+		if (fatal_signal_pending(current))
+			return -EINTR;
+		if (time_after(jiffies, timeout))
+			return -ETIMEDOUT;
+
+		memcpy(cmd.args, "\x30\x01", 2);
+		cmd.wlen = 2;
+		cmd.rlen = 11;
+		ret = si2183_cmd_execute(client, &cmd);
+		if (ret)
+			return ret;
+
+		/* engine busy */
+		if (cmd.args[2] & 0x01) {
+			msleep(10);
+			continue;
+		}
+
+		freq = cmd.args[4] | cmd.args[5] << 8 |
+			cmd.args[6] << 16 | (u32)cmd.args[7] << 24;
+		switch (cmd.args[3] & 0x3f) {
+		case SI2183_SCAN_TUNE_REQ:
+			dev_dbg(&client->dev, "scan tune %u\n", freq);
+			ret = si2183_scan_tune(fe, sat, freq);
+			if (!ret)
+				ret = si2183_scan_ctrl(client,
+						SI2183_SCAN_CONTINUE, freq);
+			if (ret)
+				return ret;
+			timeout = jiffies + msecs_to_jiffies(SI2183_SCAN_TIMEOUT);
+			break;
+		case SI2183_SCAN_FOUND:
+			res->frequency = sat ? freq : freq / 1000;
+			res->symbol_rate = (cmd.args[8] |
+					cmd.args[9] << 8) * 1000;
+			switch (cmd.args[10] & 0x0f) {
+			case 3:
+				res->delivery_system = SYS_DVBC_ANNEX_A;
+				break;
+			case 9:
+				res->delivery_system = SYS_DVBS2;
+				break;
+			case 10:
+				res->delivery_system = SYS_DSS;
+				break;
+			default:
+				res->delivery_system = SYS_DVBS;
+				break;
+			}
+			dev_dbg(&client->dev, "found %u kHz %u sym/s\n",
+					res->frequency, res->symbol_rate);
+			return 1;
+		case SI2183_SCAN_ENDED:
+			return 0;
+		case SI2183_SCAN_ERROR:
+			return -EIO;
+		default:
+			msleep(10);
+			break;
+		}
+	}
+}
+
+/*
+ * DVB-C blind acquisition: let the scan engine find the carrier around
+ * c->frequency and estimate its symbol rate, then pick the annex from it.
+ * Called from set_frontend with the tuner already on frequency, only for
+ * the SI2183_DVBC_SR_DETECT symbol rate.
+ */
+static int si2183_dvbc_detect(struct dvb_frontend *fe)
+{
+	struct dtv_frontend_properties *c = &fe->dtv_property_cache;
+	struct i2c_client *client = fe->demodulator_priv;
+	struct si2183_scan_result res;
+	struct si2183_cmd cmd;
+	u16 prop;
+	int ret;
+
+	prop = 0x38;
+	ret = si2183_set_prop(client, SI2183_PROP_MODE, &prop);
+	if (ret)
+		return ret;
+	/* cable scan range is in 65.536 kHz steps (Hz >> 16) */
+	prop = c->frequency > 500000 ? (c->frequency - 500000) >> 16 : 0;
+	ret = si2183_set_prop(client, SI2183_PROP_SCAN_FMIN, &prop);
+	if (ret)
+		return ret;
+	prop = min_t(u64, ((u64)c->frequency + 500000) >> 16, 0xffff);
+	ret = si2183_set_prop(client, SI2183_PROP_SCAN_FMAX, &prop);
+	if (ret)
+		return ret;
+	prop = SI2183_DVBC_SR_MIN;
+	ret = si2183_set_prop(client, SI2183_PROP_SCAN_SR_MIN, &prop);
+	if (ret)
+		return ret;
+	prop = SI2183_DVBC_SR_MAX;
+	ret = si2183_set_prop(client, SI2183_PROP_SCAN_SR_MAX, &prop);
+	if (ret)
 		return ret;
-	}
 
-	/* Transport Stream setting for parallel mode */
-	prop = 0x0104 | (dev->ts_clock_inv ? 0x0000 : 0x1000);
-	ret = si2183_set_prop(client, 0x1009, &prop);
-	if (ret) {
-		dev_err(&client->dev, "err set par_ts\n");
+	memcpy(cmd.args, "\x85", 1);
+	cmd.wlen = 1;
+	cmd.rlen = 1;
+	ret = si2183_cmd_execute(client, &cmd);
+	if (ret)
 		return ret;
-	}
 
-	/* Transport Stream setting for serial mode */
-	prop = 0x230C | (dev->ts_clock_inv ? 0x0000 : 0x1000);
-	ret = si2183_set_prop(client, 0x1008, &prop);
-	if (ret) {
-		dev_err(&client->dev, "err set ser_ts\n");
+	ret = si2183_scan_ctrl(client, SI2183_SCAN_START, 0);
+	if (ret)
 		return ret;
-	}
-
-	/* Transport Stream setting for parallel mode - secondary*/
-	prop = 0x08e3;
-	ret = si2183_set_prop(client, 0x1015, &prop);
-	if (ret) {
-		dev_err(&client->dev, "err set int par_ts_sec\n");
+	ret = si2183_scan_next(client, fe, false, &res);
+	si2183_scan_ctrl(client, SI2183_SCAN_ABORT, 0);
+	if (ret < 0)
 		return ret;
-	}
+	if (!ret)
+		return -ENOENT;
 
-	/* Transport Stream setting for serial mode - secondary*/
-	prop = 0x01c7;
-	ret = si2183_set_prop(client, 0x1016, &prop);
-	if (ret) {
-		dev_err(&client->dev, "err set int ser_ts_sec\n");
-		return ret;
+	dev_dbg(&client->dev, "dvb-c detected %u kHz %u sym/s\n",
+			res.frequency, res.symbol_rate);
+	c->symbol_rate = res.symbol_rate;
+	if (si2183_is_mcns_sr(res.symbol_rate)) {
+		c->delivery_system = SYS_DVBC_ANNEX_B;
+		c->bandwidth_hz = 6000000;
+	} else {
+		c->delivery_system = SYS_DVBC_ANNEX_A;
+		c->bandwidth_hz = 8000000;
 	}
 
-	dev->fw_loaded = true;
-warm:
-	dev->active = true;
-	dev->active_fe |= (1 << fe->id);
-	return 0;
+	/* back on the requested frequency with the filter of the annex */
+	return fe->ops.tuner_ops.set_params(fe);
+}
+
+/*
+ * DVB-S/S2 blind scan: the demod scan engine looks for carriers between
+ * fmin and fmax (MHz) and asks for the tuner to be moved as it goes.
+ */
+static int si2183_blindscan(struct i2c_client *client, u16 fmin, u16 fmax,
+				u16 sr_min, u16 sr_max)
+{
+	struct si2183_dev *dev = i2c_get_clientdata(client);
+	struct dvb_frontend *fe = &dev->fe;
+	struct si2183_cmd cmd;
+	u16 prop;
+	int ret;
+
+	mutex_lock(&dev->tune_mutex);
+
+	ret = si2183_takeover(dev, fe);
+	if (ret)
+		goto err;
+	dev->scan_num = 0;
+
+	/* auto detect DVB-S/S2 */
+	prop = 0x04f8;
+	ret = si2183_set_prop(client, SI2183_PROP_MODE, &prop);
+	if (ret)
+		goto err;
+	prop = fmin;
+	ret = si2183_set_prop(client, SI2183_PROP_SCAN_FMIN, &prop);
+	if (ret)
+		goto err;
+	prop = fmax;
+	ret = si2183_set_prop(client, SI2183_PROP_SCAN_FMAX, &prop);
+	if (ret)
+		goto err;
+	prop = sr_min;
+	ret = si2183_set_prop(client, SI2183_PROP_SCAN_SR_MIN, &prop);
+	if (ret)
+		goto err;
+	prop = sr_max;
+	ret = si2183_set_prop(client, SI2183_PROP_SCAN_SR_MAX, &prop);
+	if (ret)
+		goto err;
+
+	memcpy(cmd.args, "\x85", 1);
+	cmd.wlen = 1;
+	cmd.rlen = 1;
+	ret = si2183_cmd_execute(client, &cmd);
+	if (ret)
+		goto err;
+
+	ret = si2183_scan_ctrl(client, SI2183_SCAN_START, 0);
+	if (ret)
+		goto err;
 
+	while (dev->scan_num < SI2183_SCAN_MAX) {
+		ret = si2183_scan_next(client, fe, true,
+				&dev->scan[dev->scan_num]);
+		if (ret <= 0)
+			break;
+		dev->scan_num++;
+		ret = si2183_scan_ctrl(client, SI2183_SCAN_CONTINUE, 0);
+		if (ret)
+			break;
+	}
+	si2183_scan_ctrl(client, SI2183_SCAN_ABORT, 0);
+	dev_info(&client->dev, "blind scan %u-%u MHz found %d carriers\n",
+			fmin, fmax, dev->scan_num);
 err:
-	dev_dbg(&client->dev, "init failed=%d\n", ret);
+	mutex_unlock(&dev->tune_mutex);
+	if (ret)
+		dev_dbg(&client->dev, "blind scan failed=%d\n", ret);
 	return ret;
 }
 
-static int si2183_sleep(struct dvb_frontend *fe)
+/*
+ * Satellite spectrum sweep: keep the demod in DVB-S mode so its AGC loop
+ * runs, set a narrow tuner filter once and step only the PLL, reading the
+ * AGC after a short settle instead of a full tune per bin. Bins are not
+ * pipelined: the AGC read has to see the PLL of its own bin, and both go
+ * through the demod, so there is nothing to overlap with the settle.
+ */
+static int si2183_sweep(struct i2c_client *client, u32 start, u32 stop,
+				u32 step, u32 lpf)
 {
-	struct i2c_client *client = fe->demodulator_priv;
 	struct si2183_dev *dev = i2c_get_clientdata(client);
-	int ret;
+	struct dvb_frontend *fe = &dev->fe;
+	struct dtv_frontend_properties *c = &fe->dtv_property_cache;
+	struct dvb_tuner_ops *tuner = &fe->ops.tuner_ops;
+	struct si2183_sweep *sweep;
 	struct si2183_cmd cmd;
+	ktime_t t0;
+	u16 prop, agc;
+	int i, n, ret;
+
+	if (!tuner->set_frequency || !tuner->set_bandwidth ||
+	    !tuner->get_rf_strength)
+		return -EOPNOTSUPP;
+	if (lpf < SI2183_SWEEP_LPF_MIN || lpf > SI2183_SWEEP_LPF_MAX)
+		return -EINVAL;
 
-	dev_dbg(&client->dev, "\n");
-
-	dev->active_fe &= ~(1 << fe->id);
-	if (dev->active_fe)
-		return 0;
+	n = (stop - start) / step + 1;
+	sweep = kzalloc(sizeof(*sweep) + n * sizeof(sweep->level[0]),
+			GFP_KERNEL);
+	if (!sweep)
+		return -ENOMEM;
+	sweep->start = start;
+	sweep->step = step;
 
-	dev->active = false;
+	mutex_lock(&dev->tune_mutex);
+	ret = si2183_takeover(dev, fe);
+	if (ret)
+		goto err;
 
-	dev_dbg(&client->dev,"si2183_sleep\n");
-	memcpy(cmd.args, "\x13", 1);
+	prop = 0x88;
+	ret = si2183_set_prop(client, SI2183_PROP_MODE, &prop);
+	if (ret)
+		goto err;
+	memcpy(cmd.args, "\x85", 1);
 	cmd.wlen = 1;
-	cmd.rlen = 0;
+	cmd.rlen = 1;
 	ret = si2183_cmd_execute(client, &cmd);
 	if (ret)
 		goto err;
 
-	return 0;
+	ret = tuner->set_bandwidth(fe, lpf * 1000);
+	if (ret)
+		goto err;
+
+	t0 = ktime_get();
+	for (i = 0; i < n; i++) {
+		if (fatal_signal_pending(current)) {
+			ret = -EINTR;
+			goto err;
+		}
+
+		ret = tuner->set_frequency(fe, start + i * step);
+		if (ret)
+			goto err;
+		usleep_range(SI2183_SWEEP_SETTLE_US,
+				SI2183_SWEEP_SETTLE_US + 500);
+
+		memcpy(cmd.args, "\x8a\x00\x00\x00\x00\x00", 6);
+		cmd.wlen = 6;
+		cmd.rlen = 3;
+		ret = si2183_cmd_execute(client, &cmd);
+		if (ret)
+			goto err;
+
+		agc = cmd.args[1];
+		tuner->get_rf_strength(fe, &agc);
+		sweep->level[i] = c->strength.stat[0].svalue;
+		sweep->num++;
+	}
+
+	dev_info(&client->dev, "swept %d bins in %lld ms\n", n,
+			ktime_ms_delta(ktime_get(), t0));
+	swap(dev->sweep, sweep);
 err:
-	dev_dbg(&client->dev, "failed=%d\n", ret);
+	mutex_unlock(&dev->tune_mutex);
+	kfree(sweep);
+	if (ret)
+		dev_dbg(&client->dev, "sweep failed=%d\n", ret);
 	return ret;
 }
 
-static int si2183_get_tune_settings(struct dvb_frontend *fe,
-	struct dvb_frontend_tune_settings *s)
+static int si2183_spectrum_show(struct seq_file *s, void *data)
 {
-	s->min_delay_ms = 900;
+	struct i2c_client *client = s->private;
+	struct si2183_dev *dev = i2c_get_clientdata(client);
+	struct si2183_sweep *sweep;
+	int i;
 
+	mutex_lock(&dev->tune_mutex);
+	sweep = dev->sweep;
+	for (i = 0; sweep && i < sweep->num; i++)
+		seq_printf(s, "%u %d\n", sweep->start + i * sweep->step,
+				sweep->level[i]);
+	mutex_unlock(&dev->tune_mutex);
 	return 0;
 }
 
-static int si2183_select(struct i2c_mux_core *muxc, u32 chan)
+static int si2183_spectrum_open(struct inode *inode, struct file *file)
 {
-	struct i2c_client *client = i2c_mux_priv(muxc);
+	return single_open(file, si2183_spectrum_show, inode->i_private);
+}
+
+/* "start stop step [lpf]", all kHz */
+static ssize_t si2183_spectrum_write(struct file *file,
+		const char __user *ubuf, size_t len, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct i2c_client *client = s->private;
+	unsigned int start, stop, step, lpf = 4000;
+	char buf[64];
 	int ret;
+
+	if (len >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, len))
+		return -EFAULT;
+	buf[len] = 0;
+
+	if (sscanf(buf, "%u %u %u %u", &start, &stop, &step, &lpf) < 3 ||
+	    start < 950000 || stop > 2150000 || start >= stop || !step ||
+	    (stop - start) / step >= SI2183_SWEEP_MAX)
+		return -EINVAL;
+
+	ret = si2183_sweep(client, start, stop, step, lpf);
+	return ret ? ret : len;
+}
+
+static const struct file_operations si2183_spectrum_fops = {
+	.owner = THIS_MODULE,
+	.open = si2183_spectrum_open,
+	.read = seq_read,
+	.write = si2183_spectrum_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int si2183_cmp_s32(const void *a, const void *b)
+{
+	s32 x = *(const s32 *)a, y = *(const s32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Terrestrial/cable pre-scan: tune only the tuner across the raster and
+ * read the level, no demod acquisition. The noise floor is taken at the
+ * 10th percentile of the band, so it holds on a cable plant where most of
+ * the raster is occupied as long as a few channels are empty.
+ */
+static int si2183_prescan(struct i2c_client *client, u32 start, u32 stop,
+				u32 step, u32 bw)
+{
+	struct si2183_dev *dev = i2c_get_clientdata(client);
+	struct dvb_frontend *fe = NULL;
+	struct dtv_frontend_properties *c;
+	struct si2183_prescan *prescan;
 	struct si2183_cmd cmd;
+	u32 frequency, bandwidth_hz;
+	enum fe_delivery_system delsys;
+	s32 *level, *sorted, floor, margin;
+	bool dbm = false;
+	u16 prop, agc;
+	int i, n, ret;
+
+	n = (stop - start) / step + 1;
+	level = kmalloc_array(2 * n, sizeof(*level), GFP_KERNEL);
+	prescan = kzalloc(sizeof(*prescan) + n * sizeof(prescan->ch[0]),
+			GFP_KERNEL);
+	if (!level || !prescan) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+	sorted = level + n;
+
+	mutex_lock(&dev->tune_mutex);
+	for (i = 0; i < ARRAY_SIZE(dev->fes); i++)
+		if (dev->fes[i] && dev->fes[i]->ops.delsys[0] == SYS_DVBT)
+			fe = dev->fes[i];
+	if (!fe || !fe->ops.tuner_ops.set_params) {
+		ret = -EOPNOTSUPP;
+		goto err;
+	}
+	ret = si2183_takeover(dev, fe);
+	if (ret)
+		goto err;
 
-	/* open I2C gate */
-	memcpy(cmd.args, "\xc0\x0d\x01", 3);
-	cmd.wlen = 3;
-	cmd.rlen = 0;
-	ret = i2c_master_send(client, cmd.args, cmd.wlen);
-	if (ret != cmd.wlen)
-		ret = -EREMOTEIO;
+	/* DVB-T mode keeps the TER AGC loop running */
+	prop = 0x20 | (bw / 1000 & 0x0f);
+	ret = si2183_set_prop(client, SI2183_PROP_MODE, &prop);
+	if (ret)
+		goto err;
+	memcpy(cmd.args, "\x85", 1);
+	cmd.wlen = 1;
+	cmd.rlen = 1;
+	ret = si2183_cmd_execute(client, &cmd);
 	if (ret)
 		goto err;
 
-	return 0;
+	c = &fe->dtv_property_cache;
+	frequency = c->frequency;
+	bandwidth_hz = c->bandwidth_hz;
+	delsys = c->delivery_system;
+	c->delivery_system = SYS_DVBT;
+	c->bandwidth_hz = bw * 1000;
+
+	for (i = 0; i < n; i++) {
+		if (fatal_signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+
+		c->frequency = (start + i * step) * 1000;
+		ret = fe->ops.tuner_ops.set_params(fe);
+		if (ret)
+			break;
+		msleep(SI2183_PRESCAN_SETTLE_MS);
+
+		memcpy(cmd.args, "\x89\x00\x00\x00\x00\x00", 6);
+		cmd.wlen = 6;
+		cmd.rlen = 3;
+		ret = si2183_cmd_execute(client, &cmd);
+		if (ret)
+			break;
+
+		/* prefer the tuner's RSSI, fall back to the IF AGC level */
+		agc = cmd.args[2];
+		level[i] = -agc;
+		c->strength.len = 0;
+		if (fe->ops.tuner_ops.get_rf_strength &&
+		    !fe->ops.tuner_ops.get_rf_strength(fe, &agc) &&
+		    c->strength.len &&
+		    c->strength.stat[0].scale == FE_SCALE_DECIBEL) {
+			level[i] = c->strength.stat[0].svalue;
+			dbm = true;
+		}
+	}
+
+	c->frequency = frequency;
+	c->bandwidth_hz = bandwidth_hz;
+	c->delivery_system = delsys;
+	if (ret)
+		goto err;
+
+	memcpy(sorted, level, n * sizeof(*level));
+	sort(sorted, n, sizeof(*sorted), si2183_cmp_s32, NULL);
+	floor = sorted[n / SI2183_PRESCAN_FLOOR_DIV];
+	margin = dbm ? 6000 : 8;
+
+	prescan->dbm = dbm;
+	for (i = 0; i < n; i++) {
+		if (level[i] < floor + margin)
+			continue;
+		prescan->ch[prescan->num].frequency = start + i * step;
+		prescan->ch[prescan->num].level = level[i];
+		prescan->num++;
+	}
+	dev_info(&client->dev, "pre-scan found %d of %d channels occupied\n",
+			prescan->num, n);
+	swap(dev->prescan, prescan);
 err:
-	dev_dbg(&client->dev, "failed=%d\n", ret);
+	mutex_unlock(&dev->tune_mutex);
+err_free:
+	kfree(prescan);
+	kfree(level);
+	if (ret)
+		dev_dbg(&client->dev, "pre-scan failed=%d\n", ret);
 	return ret;
 }
 
-static int si2183_deselect(struct i2c_mux_core *muxc, u32 chan)
+static int si2183_prescan_show(struct seq_file *s, void *data)
 {
-	struct i2c_client *client = i2c_mux_priv(muxc);
+	struct i2c_client *client = s->private;
+	struct si2183_dev *dev = i2c_get_clientdata(client);
+	struct si2183_prescan *prescan;
+	int i;
+
+	mutex_lock(&dev->tune_mutex);
+	prescan = dev->prescan;
+	for (i = 0; prescan && i < prescan->num; i++)
+		seq_printf(s, "%u %d %s\n", prescan->ch[i].frequency,
+				prescan->ch[i].level,
+				prescan->dbm ? "mdBm" : "agc");
+	mutex_unlock(&dev->tune_mutex);
+	return 0;
+}
+
+static int si2183_prescan_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, si2183_prescan_show, inode->i_private);
+}
+
+/* "start stop step [bw]", all kHz */
+static ssize_t si2183_prescan_write(struct file *file,
+		const char __user *ubuf, size_t len, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct i2c_client *client = s->private;
+	unsigned int start, stop, step, bw = 8000;
+	char buf[64];
 	int ret;
-	struct si2183_cmd cmd;
 
-	/* close I2C gate */
-	memcpy(cmd.args, "\xc0\x0d\x00", 3);
-	cmd.wlen = 3;
-	cmd.rlen = 0;
-	ret = i2c_master_send(client, cmd.args, cmd.wlen);
-	if (ret != cmd.wlen)
-		ret = -EREMOTEIO;
-	if (ret)
-		goto err;
+	if (len >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, len))
+		return -EFAULT;
+	buf[len] = 0;
+
+	if (sscanf(buf, "%u %u %u %u", &start, &stop, &step, &bw) < 3 ||
+	    start < 42000 || stop > 1002000 || start >= stop || !step ||
+	    (stop - start) / step >= SI2183_PRESCAN_MAX ||
+	    bw < 1700 || bw > 8000)
+		return -EINVAL;
+
+	ret = si2183_prescan(client, start, stop, step, bw);
+	return ret ? ret : len;
+}
+
+static const struct file_operations si2183_prescan_fops = {
+	.owner = THIS_MODULE,
+	.open = si2183_prescan_open,
+	.read = seq_read,
+	.write = si2183_prescan_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int si2183_blindscan_show(struct seq_file *s, void *data)
+{
+	struct i2c_client *client = s->private;
+	struct si2183_dev *dev = i2c_get_clientdata(client);
+	int i;
 
+	mutex_lock(&dev->tune_mutex);
+	for (i = 0; i < dev->scan_num; i++)
+		seq_printf(s, "%u %u %s\n", dev->scan[i].frequency,
+			dev->scan[i].symbol_rate,
+			dev->scan[i].delivery_system == SYS_DVBS2 ? "DVB-S2" :
+			dev->scan[i].delivery_system == SYS_DSS ? "DSS" :
+			"DVB-S");
+	mutex_unlock(&dev->tune_mutex);
 	return 0;
-err:
-	dev_dbg(&client->dev, "failed=%d\n", ret);
-	return ret;
 }
 
-static int si2183_tune(struct dvb_frontend *fe, bool re_tune,
-	unsigned int mode_flags, unsigned int *delay, enum fe_status *status)
+static int si2183_blindscan_open(struct inode *inode, struct file *file)
 {
-	*delay = HZ / 5;
-	if (re_tune) {
-		int ret = si2183_set_frontend(fe);
-		if (ret)
-			return ret;
-	}
-	return si2183_read_status(fe, status);
+	return single_open(file, si2183_blindscan_show, inode->i_private);
 }
 
-static enum dvbfe_algo si2183_get_algo(struct dvb_frontend *fe)
+/* "fmin fmax [sr_min sr_max]", MHz and ksym/s */
+static ssize_t si2183_blindscan_write(struct file *file,
+		const char __user *ubuf, size_t len, loff_t *ppos)
 {
-	return DVBFE_ALGO_HW;
+	struct seq_file *s = file->private_data;
+	struct i2c_client *client = s->private;
+	unsigned int fmin, fmax, sr_min = 1000, sr_max = 45000;
+	char buf[48];
+	int ret;
+
+	if (len >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, len))
+		return -EFAULT;
+	buf[len] = 0;
+
+	if (sscanf(buf, "%u %u %u %u", &fmin, &fmax, &sr_min, &sr_max) < 2 ||
+	    fmin < 950 || fmax > 2150 || fmin >= fmax ||
+	    sr_min < 1000 || sr_max > 45000 || sr_min > sr_max)
+		return -EINVAL;
+
+	ret = si2183_blindscan(client, fmin, fmax, sr_min, sr_max);
+	return ret ? ret : len;
 }
 
+static const struct file_operations si2183_blindscan_fops = {
+	.owner = THIS_MODULE,
+	.open = si2183_blindscan_open,
+	.read = seq_read,
+	.write = si2183_blindscan_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static int si2183_send_diseqc_cmd(struct dvb_frontend *fe,
 	u8 cont_tone, u8 tone_burst, u8 burst_sel,
 	u8 end_seq, u8 msg_len, u8 *msg)
@@ -1356,14 +3261,13 @@ static const struct dvb_frontend_ops si2183_ops = {
 			FE_CAN_MULTISTREAM
 	},
 
-	.get_tune_settings = si2183_get_tune_settings,
-
 	.init = si2183_init,
 	.sleep = si2183_sleep,
 
 	.set_frontend = si2183_set_frontend,
 	.tune = si2183_tune,
 	.get_frontend_algo = si2183_get_algo,
+	.get_frontend = si2183_get_frontend,
 
 	.read_status = si2183_read_status,
 	.read_signal_strength	= si2183_read_signal_strength,
@@ -1382,7 +3286,8 @@ static int si2183_probe(struct i2c_client *client,
 {
 	struct si2183_config *config = client->dev.platform_data;
 	struct si2183_dev *dev;
-	int ret = 0;
+	char name[32];
+	int i, ret = 0;
 
 	dev_dbg(&client->dev, "\n");
 
@@ -1393,6 +3298,9 @@ static int si2183_probe(struct i2c_client *client,
 		goto err;
 	}
 	mutex_init(&dev->i2c_mutex);
+	mutex_init(&dev->tune_mutex);
+	seqlock_init(&dev->stats_lock);
+	INIT_DELAYED_WORK(&dev->stats_work, si2183_stats_work);
 	/* create mux i2c adapter for tuner */ 
 	dev->muxc = i2c_mux_alloc(client->adapter, &client->dev,
 				  1, 0, I2C_MUX_LOCKED,
@@ -1426,9 +3334,20 @@ static int si2183_probe(struct i2c_client *client,
 	dev->stat_resp = 0;
 
 	dev->active_fe = 0;
+	for (i = 0; i < ARRAY_SIZE(si2183_cmd_hint); i++)
+		dev->cmd_est_us[si2183_cmd_hint[i].cmd] = si2183_cmd_hint[i].us;
 
 	i2c_set_clientdata(client, dev);
 
+	snprintf(name, sizeof(name), "si2183-%s", dev_name(&client->dev));
+	dev->debugfs = debugfs_create_dir(name, NULL);
+	debugfs_create_file("blindscan", 0600, dev->debugfs, client,
+			&si2183_blindscan_fops);
+	debugfs_create_file("spectrum", 0600, dev->debugfs, client,
+			&si2183_spectrum_fops);
+	debugfs_create_file("prescan", 0600, dev->debugfs, client,
+			&si2183_prescan_fops);
+
 	dev_info(&client->dev, "Silicon Labs Si2183 successfully attached\n");
 	return 0;
 err_kfree:
@@ -1442,8 +3361,13 @@ static int si2183_remove(struct i2c_client *client)
 {
 	struct si2183_dev *dev = i2c_get_clientdata(client);
 
-	dev_dbg(&client->dev, "\n");
+	dev_dbg(&client->dev, "%llu commands, %llu CTS polls, %llu property writes skipped\n",
+			dev->cmd_count, dev->cmd_polls, dev->prop_skipped);
+	debugfs_remove_recursive(dev->debugfs);
+	cancel_delayed_work_sync(&dev->stats_work);
 	i2c_mux_del_adapters(dev->muxc); 
+	kfree(dev->sweep);
+	kfree(dev->prescan);
 
 	dev->fe.ops.release = NULL;
 	dev->fe.demodulator_priv = NULL;
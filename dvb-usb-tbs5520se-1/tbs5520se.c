@@ -10,6 +10,7 @@
  */
 
 #include <linux/version.h>
+#include <linux/nvmem-provider.h>
 #include "tbs5520se.h"
 #include "si2183.h"
 #include "si2157.h"
@@ -22,9 +23,59 @@
 #define TBS5520SE_LED_CTRL (0x1b00)
 #define TBS5520SE_VOLTAGE_CTRL (0x1800)
 
+/* preallocated control transfer buffers */
+#define TBS5520SE_CTRL_BUFS 4
+#define TBS5520SE_CTRL_BUFSIZE 64
+
+/*
+ * Largest I2C payload per vendor request: the 20 byte buffers the
+ * original transfer code used, less the len and addr header on writes.
+ * Longer reads are split into several requests.
+ */
+#define TBS5520SE_I2C_MAX_WRITE 18
+#define TBS5520SE_I2C_MAX_READ 20
+
+/* FX2 firmware download: longest 0xA0 write and the classic fallback size */
+#define TBS5520SE_FW_CHUNK 0x1000
+#define TBS5520SE_FW_BLOCK 0x40
+/* code RAM compared against the image to detect running firmware */
+#define TBS5520SE_FW_SIG_LEN 0x100
+
+/* 24C02 holding the MAC address at offset 16 */
+#define TBS5520SE_EEPROM_ADDR 0x50
+#define TBS5520SE_EEPROM_SIZE 256
+
+/* one vendor request of a batched transaction */
+struct tbs5520se_ctrl_step {
+	u8 request;
+	int flags;
+	u8 *data;
+	u16 len;
+};
+
 struct tbs5520se_state {
 	struct i2c_client *i2c_client_demod, *i2c_client_sattuner, *i2c_client_tertuner;
 	struct dvb_frontend fe, *fe_ter;
+
+	/* DMA-capable buffers for tbs5520se_op_rw(), allocated in priv_init */
+	u8 *ctrl_buf[TBS5520SE_CTRL_BUFS];
+	unsigned long ctrl_buf_busy;
+	atomic_long_t ctrl_allocs_avoided;
+
+	/* one control urb per buffer for tbs5520se_op_batch() */
+	struct urb *ctrl_urb[TBS5520SE_CTRL_BUFS];
+	struct usb_ctrlrequest *ctrl_setup;
+	struct usb_anchor ctrl_anchor;
+
+	/* pending I2C requests, protected by the dvb-usb i2c_mutex */
+	struct tbs5520se_ctrl_step i2c_step[TBS5520SE_CTRL_BUFS];
+	u8 i2c_wbuf[TBS5520SE_CTRL_BUFS][TBS5520SE_CTRL_BUFSIZE];
+	int i2c_num;
+
+	/* EEPROM image, read once and exported through nvmem */
+	u8 eeprom[TBS5520SE_EEPROM_SIZE];
+	bool eeprom_valid;
+	struct nvmem_device *nvmem;
 };
 
 /* debug */
@@ -33,118 +84,363 @@ module_param_named(debug, dvb_usb_tbs5520se_debug, int, 0644);
 MODULE_PARM_DESC(debug, "set debugging level (1=info 2=xfer (or-able))." 
 							DVB_USB_DEBUG_STATUS);
 
+static int dvb_usb_tbs5520se_fw_reload;
+module_param_named(fw_reload, dvb_usb_tbs5520se_fw_reload, int, 0644);
+MODULE_PARM_DESC(fw_reload, "always download the FX2 firmware, even if "
+			"it is already running (default: 0)");
+
 DVB_DEFINE_MOD_OPT_ADAPTER_NR(adapter_nr);
 
-static int tbs5520se_op_rw(struct usb_device *dev, u8 request, u16 value,
-				u16 index, u8 * data, u16 len, int flags)
+/* send a vendor request, buf must be DMA-capable */
+static int tbs5520se_ctrl_msg(struct usb_device *dev, u8 request, u16 value,
+				u16 index, u8 *buf, u16 len, int flags)
 {
 	int ret;
-	void *u8buf;
 
 	unsigned int pipe = (flags == TBS5520SE_READ_MSG) ?
 			usb_rcvctrlpipe(dev, 0) : usb_sndctrlpipe(dev, 0);
 	u8 request_type = (flags == TBS5520SE_READ_MSG) ? USB_DIR_IN : USB_DIR_OUT;
-	u8buf = kmalloc(len, GFP_KERNEL);
-	if (!u8buf)
-		return -ENOMEM;
 
-	if (flags == TBS5520SE_WRITE_MSG)
-		memcpy(u8buf, data, len);
 	ret = usb_control_msg(dev, pipe, request, request_type | USB_TYPE_VENDOR,
-				value, index , u8buf, len, 2000);
+				value, index , buf, len, 2000);
 	if(ret != len)
 		info("tbs5520se_op_rw req=%x val=%x ind=%x len=%i fla=%x ret=%i",request,value,index,len,flags,ret);
 
+	return ret;
+}
+
+static u8 *tbs5520se_get_buf(struct tbs5520se_state *st)
+{
+	int i;
+
+	for (i = 0; i < TBS5520SE_CTRL_BUFS; i++) {
+		if (st->ctrl_buf[i] && !test_and_set_bit(i, &st->ctrl_buf_busy))
+			return st->ctrl_buf[i];
+	}
+	return NULL;
+}
+
+static void tbs5520se_put_buf(struct tbs5520se_state *st, u8 *buf)
+{
+	int i;
+
+	for (i = 0; i < TBS5520SE_CTRL_BUFS; i++) {
+		if (st->ctrl_buf[i] == buf) {
+			clear_bit(i, &st->ctrl_buf_busy);
+			return;
+		}
+	}
+	kfree(buf);
+}
+
+static int tbs5520se_op_rw(struct dvb_usb_device *d, u8 request, u16 value,
+				u16 index, u8 * data, u16 len, int flags)
+{
+	struct tbs5520se_state *st = d->priv;
+	int ret;
+	u8 *buf = NULL;
+	bool pooled;
+
+	if (len <= TBS5520SE_CTRL_BUFSIZE)
+		buf = tbs5520se_get_buf(st);
+	pooled = buf != NULL;
+	if (!buf) {
+		/* pool exhausted or oversized request */
+		buf = kmalloc(len, GFP_KERNEL);
+		if (!buf)
+			return -ENOMEM;
+	}
+
+	if (flags == TBS5520SE_WRITE_MSG)
+		memcpy(buf, data, len);
+	ret = tbs5520se_ctrl_msg(d->udev, request, value, index, buf, len, flags);
 	if (flags == TBS5520SE_READ_MSG)
-		memcpy(data, u8buf, len);
-	kfree(u8buf);
+		memcpy(data, buf, len);
+	if (pooled && ret == len)
+		atomic_long_inc(&st->ctrl_allocs_avoided);
+	tbs5520se_put_buf(st, buf);
 	return ret;
 }
 
+static void tbs5520se_ctrl_complete(struct urb *urb)
+{
+	/* nothing to do, completion is tracked through ctrl_anchor */
+}
+
+/* queue dependent vendor requests back to back and wait once for all */
+static int tbs5520se_op_batch(struct dvb_usb_device *d,
+				struct tbs5520se_ctrl_step *step, int num)
+{
+	struct tbs5520se_state *st = d->priv;
+	struct usb_ctrlrequest *setup;
+	struct urb *urb;
+	unsigned int pipe;
+	int i, queued, ret = 0;
+
+	if (num > TBS5520SE_CTRL_BUFS)
+		goto sync;
+	for (i = 0; i < num; i++)
+		if (step[i].len > TBS5520SE_CTRL_BUFSIZE)
+			goto sync;
+	for (i = 0; i < num; i++) {
+		if (test_and_set_bit(i, &st->ctrl_buf_busy)) {
+			while (i--)
+				clear_bit(i, &st->ctrl_buf_busy);
+			goto sync;
+		}
+	}
+
+	for (i = 0; i < num; i++) {
+		urb = st->ctrl_urb[i];
+		setup = &st->ctrl_setup[i];
+		if (step[i].flags == TBS5520SE_READ_MSG) {
+			pipe = usb_rcvctrlpipe(d->udev, 0);
+			setup->bRequestType = USB_DIR_IN | USB_TYPE_VENDOR;
+		} else {
+			pipe = usb_sndctrlpipe(d->udev, 0);
+			setup->bRequestType = USB_DIR_OUT | USB_TYPE_VENDOR;
+			memcpy(st->ctrl_buf[i], step[i].data, step[i].len);
+		}
+		setup->bRequest = step[i].request;
+		setup->wValue = 0;
+		setup->wIndex = 0;
+		setup->wLength = cpu_to_le16(step[i].len);
+
+		usb_fill_control_urb(urb, d->udev, pipe, (u8 *)setup,
+				st->ctrl_buf[i], step[i].len,
+				tbs5520se_ctrl_complete, st);
+		usb_anchor_urb(urb, &st->ctrl_anchor);
+		ret = usb_submit_urb(urb, GFP_KERNEL);
+		if (ret) {
+			usb_unanchor_urb(urb);
+			break;
+		}
+	}
+	queued = i;
+
+	if (!usb_wait_anchor_empty_timeout(&st->ctrl_anchor, 2000)) {
+		usb_kill_anchored_urbs(&st->ctrl_anchor);
+		ret = -ETIMEDOUT;
+	}
+
+	for (i = 0; i < queued; i++) {
+		urb = st->ctrl_urb[i];
+		if (!ret && urb->status)
+			ret = urb->status;
+		else if (!ret && urb->actual_length != step[i].len)
+			ret = -EREMOTEIO;
+		if (step[i].flags == TBS5520SE_READ_MSG)
+			memcpy(step[i].data, st->ctrl_buf[i], step[i].len);
+	}
+	for (i = 0; i < num; i++)
+		clear_bit(i, &st->ctrl_buf_busy);
+	if (!ret)
+		atomic_long_add(num, &st->ctrl_allocs_avoided);
+
+	if (ret)
+		info("tbs5520se_op_batch req=%x num=%i ret=%i",
+			step[0].request, num, ret);
+	return ret;
+
+sync:
+	for (i = 0; i < num; i++) {
+		ret = tbs5520se_op_rw(d, step[i].request, 0, 0,
+				step[i].data, step[i].len, step[i].flags);
+		if (ret != step[i].len)
+			return ret < 0 ? ret : -EREMOTEIO;
+	}
+	return 0;
+}
+
 /* I2C */
+static int tbs5520se_i2c_flush(struct dvb_usb_device *d)
+{
+	struct tbs5520se_state *st = d->priv;
+	int ret = 0;
+
+	if (st->i2c_num)
+		ret = tbs5520se_op_batch(d, st->i2c_step, st->i2c_num);
+	st->i2c_num = 0;
+	return ret;
+}
+
+/* queue a write request, the caller fills the returned buffer */
+static u8 *tbs5520se_i2c_queue_wr(struct dvb_usb_device *d, u8 request,
+					u16 len, int *ret)
+{
+	struct tbs5520se_state *st = d->priv;
+	struct tbs5520se_ctrl_step *step;
+
+	if (st->i2c_num == TBS5520SE_CTRL_BUFS) {
+		*ret = tbs5520se_i2c_flush(d);
+		if (*ret)
+			return NULL;
+	}
+	step = &st->i2c_step[st->i2c_num];
+	step->request = request;
+	step->flags = TBS5520SE_WRITE_MSG;
+	step->data = st->i2c_wbuf[st->i2c_num];
+	step->len = len;
+	st->i2c_num++;
+	return step->data;
+}
+
+/* queue a 0x91 read of len bytes into buf */
+static int tbs5520se_i2c_queue_rd(struct dvb_usb_device *d, u8 *buf, u16 len)
+{
+	struct tbs5520se_state *st = d->priv;
+	struct tbs5520se_ctrl_step *step;
+	int ret;
+
+	if (st->i2c_num == TBS5520SE_CTRL_BUFS) {
+		ret = tbs5520se_i2c_flush(d);
+		if (ret)
+			return ret;
+	}
+	step = &st->i2c_step[st->i2c_num];
+	step->request = 0x91;
+	step->flags = TBS5520SE_READ_MSG;
+	step->data = buf;
+	step->len = len;
+	st->i2c_num++;
+	return 0;
+}
+
+/* plain write: 0x80 { len + 1, addr, data } */
+static int tbs5520se_i2c_wr(struct dvb_usb_device *d, struct i2c_msg *msg)
+{
+	int ret = 0;
+	u8 *buf;
+
+	if (msg->len > TBS5520SE_I2C_MAX_WRITE)
+		return -EOPNOTSUPP;
+
+	buf = tbs5520se_i2c_queue_wr(d, 0x80, msg->len + 2, &ret);
+	if (!buf)
+		return ret;
+	buf[0] = msg->len + 1;
+	buf[1] = msg->addr << 1;
+	memcpy(buf + 2, msg->buf, msg->len);
+	return 0;
+}
+
+/* plain read: 0x93 { len, addr | 1 }, then 0x91 */
+static int tbs5520se_i2c_rd(struct dvb_usb_device *d, struct i2c_msg *msg)
+{
+	int ret = 0;
+	u8 *buf;
+
+	if (msg->len > TBS5520SE_I2C_MAX_READ)
+		return -EOPNOTSUPP;
+
+	buf = tbs5520se_i2c_queue_wr(d, 0x93, 2, &ret);
+	if (!buf)
+		return ret;
+	buf[0] = msg->len;
+	buf[1] = (msg->addr << 1) | 0x01;
+	return tbs5520se_i2c_queue_rd(d, msg->buf, msg->len);
+}
+
+/*
+ * register read: 0x90 { len, addr, reg }, then 0x91. The FX2 takes exactly
+ * these 3 bytes, so only 1-byte register addresses are supported. Reads
+ * longer than one request are split, advancing the register address.
+ */
+static int tbs5520se_i2c_rd_reg(struct dvb_usb_device *d,
+				struct i2c_msg *wr, struct i2c_msg *rd)
+{
+	int n, off, ret = 0;
+	u8 *buf;
+
+	/* nothing to read, the register write still has to go out */
+	if (rd->len == 0)
+		return tbs5520se_i2c_wr(d, wr);
+	if (wr->len != 1)
+		return -EOPNOTSUPP;
+
+	for (off = 0; off < rd->len; off += n) {
+		n = min_t(int, rd->len - off, TBS5520SE_I2C_MAX_READ);
+		buf = tbs5520se_i2c_queue_wr(d, 0x90, 3, &ret);
+		if (!buf)
+			return ret;
+		buf[0] = n;
+		buf[1] = wr->addr << 1;
+		buf[2] = wr->buf[0] + off;
+		ret = tbs5520se_i2c_queue_rd(d, rd->buf + off, n);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
 static int tbs5520se_i2c_transfer(struct i2c_adapter *adap, 
 					struct i2c_msg msg[], int num)
 {
 	struct dvb_usb_device *d = i2c_get_adapdata(adap);
-	int i = 0;
-	u8 buf6[20];
-	u8 inbuf[20];
+	struct tbs5520se_state *st;
+	int i, ret = 0;
+	u8 buf6[4];
 
 	if (!d)
 		return -ENODEV;
 	if (mutex_lock_interruptible(&d->i2c_mutex) < 0)
 		return -EAGAIN;
+	st = d->priv;
 
-	switch (num) {
-	case 2:
-		buf6[0]=msg[1].len;//lenth
-		buf6[1]=msg[0].addr<<1;//demod addr
-		//register
-		buf6[2] = msg[0].buf[0];
-
-		tbs5520se_op_rw(d->udev, 0x90, 0, 0,
-					buf6, 3, TBS5520SE_WRITE_MSG);
-		//msleep(5);
-		tbs5520se_op_rw(d->udev, 0x91, 0, 0,
-					inbuf, buf6[0], TBS5520SE_READ_MSG);
-		memcpy(msg[1].buf, inbuf, msg[1].len);
-
-		break;
-	case 1:
-		switch (msg[0].addr) {
-		case 0x67:
-		case 0x62:
-		case 0x61:
-			if (msg[0].flags == 0) {
-				buf6[0] = msg[0].len+1;//lenth
-				buf6[1] = msg[0].addr<<1;//addr
-				for(i=0;i<msg[0].len;i++) {
-					buf6[2+i] = msg[0].buf[i];//register
-				}
-				tbs5520se_op_rw(d->udev, 0x80, 0, 0,
-					buf6, msg[0].len+2, TBS5520SE_WRITE_MSG);
-			} else {
-				buf6[0] = msg[0].len;//length
-				buf6[1] = (msg[0].addr<<1) | 0x01;//addr
-				tbs5520se_op_rw(d->udev, 0x93, 0, 0,
-						buf6, 2, TBS5520SE_WRITE_MSG);
-				//msleep(5);
-				tbs5520se_op_rw(d->udev, 0x91, 0, 0,
-					inbuf, buf6[0], TBS5520SE_READ_MSG);
-				memcpy(msg[0].buf, inbuf, msg[0].len);
-			}
-			//msleep(3);
-		break;
+	for (i = 0; i < num && !ret; i++) {
+		switch (msg[i].addr) {
 		case (TBS5520SE_VOLTAGE_CTRL):
+			ret = tbs5520se_i2c_flush(d);
+			if (ret)
+				break;
 			buf6[0] = 0x01;
-			buf6[1] = msg[0].buf[1];/* off-on */
-			tbs5520se_op_rw(d->udev, 0x8a, 0, 0, buf6, 2, TBS5520SE_WRITE_MSG);
+			buf6[1] = msg[i].buf[1];/* off-on */
+			tbs5520se_op_rw(d, 0x8a, 0, 0, buf6, 2, TBS5520SE_WRITE_MSG);
 
 			buf6[0] = 0x03;
-			buf6[1] = msg[0].buf[0];/* 13v-18v */
-			tbs5520se_op_rw(d->udev, 0x8a, 0, 0, buf6, 2, TBS5520SE_WRITE_MSG);
+			buf6[1] = msg[i].buf[0];/* 13v-18v */
+			tbs5520se_op_rw(d, 0x8a, 0, 0, buf6, 2, TBS5520SE_WRITE_MSG);
 			break;
 		case (TBS5520SE_LED_CTRL):
+			ret = tbs5520se_i2c_flush(d);
+			if (ret)
+				break;
 			buf6[0] = 0x05;
-			buf6[1] = msg[0].buf[0];
-			tbs5520se_op_rw(d->udev, 0x8a, 0, 0, buf6, 2, TBS5520SE_WRITE_MSG);
+			buf6[1] = msg[i].buf[0];
+			tbs5520se_op_rw(d, 0x8a, 0, 0, buf6, 2, TBS5520SE_WRITE_MSG);
 			break;
 		case (TBS5520SE_RC_QUERY):
-			tbs5520se_op_rw(d->udev, 0xb8, 0, 0,
+			ret = tbs5520se_i2c_flush(d);
+			if (ret)
+				break;
+			tbs5520se_op_rw(d, 0xb8, 0, 0,
 					buf6, 4, TBS5520SE_READ_MSG);
-			msg[0].buf[0] = buf6[2];
-			msg[0].buf[1] = buf6[3];
+			msg[i].buf[0] = buf6[2];
+			msg[i].buf[1] = buf6[3];
 			//msleep(3);
 			//info("TBS5520SE_RC_QUERY %x %x %x %x\n",
 			//		buf6[0],buf6[1],buf6[2],buf6[3]);
 			break;
+		default:
+			if (msg[i].flags & I2C_M_RD) {
+				ret = tbs5520se_i2c_rd(d, &msg[i]);
+			} else if (i + 1 < num && (msg[i + 1].flags & I2C_M_RD) &&
+					msg[i + 1].addr == msg[i].addr) {
+				ret = tbs5520se_i2c_rd_reg(d, &msg[i], &msg[i + 1]);
+				i++;
+			} else {
+				ret = tbs5520se_i2c_wr(d, &msg[i]);
+			}
+			break;
 		}
-
-		break;
 	}
+	if (!ret)
+		ret = tbs5520se_i2c_flush(d);
+	else
+		st->i2c_num = 0;
 
 	mutex_unlock(&d->i2c_mutex);
-	return num;
+	return ret ? ret : num;
 }
 
 static u32 tbs5520se_i2c_func(struct i2c_adapter *adapter)
@@ -200,34 +496,73 @@ static int tbs5520se_set_voltage(struct dvb_frontend *fe,
 	return 0;
 }
 
+static int tbs5520se_eeprom_read(void *priv, unsigned int offset,
+					void *val, size_t bytes)
+{
+	struct tbs5520se_state *st = priv;
+
+	memcpy(val, st->eeprom + offset, bytes);
+	return 0;
+}
+
+/* sequential read of the whole EEPROM, split into 0x91 sized chunks */
+static int tbs5520se_read_eeprom(struct dvb_usb_device *d)
+{
+	struct tbs5520se_state *st = d->priv;
+	struct nvmem_config cfg = {};
+	u8 reg = 0;
+	int i, ret;
+	struct i2c_msg msg[] = {
+		{ .addr = TBS5520SE_EEPROM_ADDR, .flags = 0,
+			.buf = &reg, .len = 1 },
+		{ .addr = TBS5520SE_EEPROM_ADDR, .flags = I2C_M_RD,
+			.buf = st->eeprom, .len = TBS5520SE_EEPROM_SIZE },
+	};
+
+	if (st->eeprom_valid)
+		return 0;
+
+	ret = i2c_transfer(&d->i2c_adap, msg, 2);
+	if (ret != 2)
+		return ret < 0 ? ret : -EREMOTEIO;
+	st->eeprom_valid = true;
+
+	for (i = 0; i < TBS5520SE_EEPROM_SIZE; i += 16) {
+		deb_xfer("%02x: ", i);
+		debug_dump((st->eeprom + i), 16, deb_xfer);
+	}
+
+	cfg.dev = &d->udev->dev;
+	cfg.name = "tbs5520se-eeprom";
+	/* older kernels lack auto ids, a second box then just skips the export */
+#ifdef NVMEM_DEVID_AUTO
+	cfg.id = NVMEM_DEVID_AUTO;
+#endif
+	cfg.owner = THIS_MODULE;
+	cfg.read_only = true;
+	cfg.reg_read = tbs5520se_eeprom_read;
+	cfg.size = TBS5520SE_EEPROM_SIZE;
+	cfg.word_size = 1;
+	cfg.stride = 1;
+	cfg.priv = st;
+	st->nvmem = nvmem_register(&cfg);
+	if (IS_ERR(st->nvmem)) {
+		deb_info("no nvmem export of the EEPROM (%ld)\n",
+			PTR_ERR(st->nvmem));
+		st->nvmem = NULL;
+	}
+	return 0;
+}
+
 static int tbs5520se_read_mac_address(struct dvb_usb_device *d, u8 mac[6])
 {
-	int i,ret;
-	u8 ibuf[3] = {0, 0, 0};
-	u8 eeprom[256], eepromline[16];
-
-	for (i = 0; i < 256; i++) {
-		ibuf[0]=1;//lenth
-		ibuf[1]=0xa0;//eeprom addr
-		ibuf[2]=i;//register
-		ret = tbs5520se_op_rw(d->udev, 0x90, 0, 0,
-					ibuf, 3, TBS5520SE_WRITE_MSG);
-		ret = tbs5520se_op_rw(d->udev, 0x91, 0, 0,
-					ibuf, 1, TBS5520SE_READ_MSG);
-			if (ret < 0) {
-				err("read eeprom failed.");
-				return -1;
-			} else {
-				eepromline[i%16] = ibuf[0];
-				eeprom[i] = ibuf[0];
-			}
-			
-			if ((i % 16) == 15) {
-				deb_xfer("%02x: ", i - 15);
-				debug_dump(eepromline, 16, deb_xfer);
-			}
+	struct tbs5520se_state *st = d->priv;
+
+	if (tbs5520se_read_eeprom(d) < 0) {
+		err("read eeprom failed.");
+		return -1;
 	}
-	memcpy(mac, eeprom + 16, 6);
+	memcpy(mac, st->eeprom + 16, 6);
 	return 0;
 };
 
@@ -287,7 +622,7 @@ static int tbs5520se_frontend_attach(struct dvb_usb_adapter *adap)
 		return -ENODEV;
 	buf[0] = 1;
 	buf[1] = 0;
-	tbs5520se_op_rw(d->udev, 0x8a, 0, 0,
+	tbs5520se_op_rw(d, 0x8a, 0, 0,
 			buf, 2, TBS5520SE_WRITE_MSG);
 	adap->fe_adap[0].fe->ops.set_voltage = tbs5520se_set_voltage;
 
@@ -312,11 +647,11 @@ static int tbs5520se_frontend_attach(struct dvb_usb_adapter *adap)
 		return -ENODEV;
 	buf[0] = 0;
 	buf[1] = 0;
-	tbs5520se_op_rw(d->udev, 0xb7, 0, 0,
+	tbs5520se_op_rw(d, 0xb7, 0, 0,
 			buf, 2, TBS5520SE_WRITE_MSG);
 	buf[0] = 8;
 	buf[1] = 1;
-	tbs5520se_op_rw(d->udev, 0x8a, 0, 0,
+	tbs5520se_op_rw(d, 0x8a, 0, 0,
 			buf, 2, TBS5520SE_WRITE_MSG);
 
 	strlcpy(adap->fe_adap[0].fe->ops.info.name,d->props.devices[0].name,sizeof(adap->fe_adap[0].fe->ops.info.name));
@@ -337,9 +672,10 @@ MODULE_DEVICE_TABLE(usb, tbs5520se_table);
 static int tbs5520se_load_firmware(struct usb_device *dev,
 			const struct firmware *frmwr)
 {
-	u8 *b, *p;
-	int ret = 0, i;
-	u8 reset;
+	u8 *buf;
+	int ret = 0, reqs = 0;
+	int i, len, chunk = TBS5520SE_FW_CHUNK;
+	ktime_t start;
 	const struct firmware *fw;
 	switch (dev->descriptor.idProduct) {
 	case 0x5521:
@@ -356,47 +692,156 @@ static int tbs5520se_load_firmware(struct usb_device *dev,
 		break;
 	}
 	info("start downloading TBS5520se firmware");
-	p = kmalloc(fw->size, GFP_KERNEL);
-	reset = 1;
+	start = ktime_get();
+
+	/* one bounce buffer for the whole download */
+	buf = kmalloc(TBS5520SE_FW_CHUNK, GFP_KERNEL);
+	if (!buf) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
 	/*stop the CPU*/
-	tbs5520se_op_rw(dev, 0xa0, 0x7f92, 0, &reset, 1, TBS5520SE_WRITE_MSG);
-	tbs5520se_op_rw(dev, 0xa0, 0xe600, 0, &reset, 1, TBS5520SE_WRITE_MSG);
-
-	if (p != NULL) {
-		memcpy(p, fw->data, fw->size);
-		for (i = 0; i < fw->size; i += 0x40) {
-			b = (u8 *) p + i;
-			if (tbs5520se_op_rw(dev, 0xa0, i, 0, b , 0x40,
-					TBS5520SE_WRITE_MSG) != 0x40) {
-				err("error while transferring firmware");
-				ret = -EINVAL;
-				break;
-			}
-		}
-		/* restart the CPU */
-		reset = 0;
-		if (ret || tbs5520se_op_rw(dev, 0xa0, 0x7f92, 0, &reset, 1,
-					TBS5520SE_WRITE_MSG) != 1) {
-			err("could not restart the USB controller CPU.");
-			ret = -EINVAL;
+	buf[0] = 1;
+	tbs5520se_ctrl_msg(dev, 0xa0, 0x7f92, 0, buf, 1, TBS5520SE_WRITE_MSG);
+	tbs5520se_ctrl_msg(dev, 0xa0, 0xe600, 0, buf, 1, TBS5520SE_WRITE_MSG);
+
+	/*
+	 * Every byte is written, 0xff runs included: FX2 RAM is not erased
+	 * by the reset, so a skipped block would keep stale contents.
+	 */
+	for (i = 0; i < fw->size; i += len) {
+		len = min_t(int, fw->size - i, chunk);
+		memcpy(buf, fw->data + i, len);
+		if (tbs5520se_ctrl_msg(dev, 0xa0, i, 0, buf, len,
+				TBS5520SE_WRITE_MSG) == len) {
+			reqs++;
+			continue;
 		}
-		if (ret || tbs5520se_op_rw(dev, 0xa0, 0xe600, 0, &reset, 1,
-					TBS5520SE_WRITE_MSG) != 1) {
-			err("could not restart the USB controller CPU.");
-			ret = -EINVAL;
+		if (chunk > TBS5520SE_FW_BLOCK) {
+			/* retry this part with the classic 64 byte writes */
+			info("long firmware writes failed, using %d byte writes",
+				TBS5520SE_FW_BLOCK);
+			chunk = TBS5520SE_FW_BLOCK;
+			len = 0;
+			continue;
 		}
+		err("error while transferring firmware");
+		ret = -EINVAL;
+		break;
+	}
 
-		msleep(100);
-		kfree(p);
+	/* restart the CPU */
+	buf[0] = 0;
+	if (ret || tbs5520se_ctrl_msg(dev, 0xa0, 0x7f92, 0, buf, 1,
+				TBS5520SE_WRITE_MSG) != 1) {
+		err("could not restart the USB controller CPU.");
+		ret = -EINVAL;
 	}
+	if (ret || tbs5520se_ctrl_msg(dev, 0xa0, 0xe600, 0, buf, 1,
+				TBS5520SE_WRITE_MSG) != 1) {
+		err("could not restart the USB controller CPU.");
+		ret = -EINVAL;
+	}
+	kfree(buf);
+
+	if (!ret)
+		info("TBS5520se firmware downloaded in %lld ms "
+			"(%d requests)",
+			ktime_ms_delta(ktime_get(), start), reqs);
+	msleep(100);
+out:
+	if (fw != frmwr)
+		release_firmware(fw);
 	return ret;
 }
 
+/*
+ * The FX2 core answers 0xA0 reads whether or not our firmware runs. If
+ * the 8051 is out of reset (CPUCS bit 0 clear) and its code RAM starts
+ * with our image, the device is already warm and needs no download.
+ */
+static int tbs5520se_identify_state(struct usb_device *dev,
+		const struct dvb_usb_device_properties *props,
+		const struct dvb_usb_device_description **desc, int *cold)
+{
+	const struct firmware *fw;
+	int len;
+	u8 *buf;
+
+	if (dvb_usb_tbs5520se_fw_reload)
+		return 0;
+
+	buf = kmalloc(TBS5520SE_FW_SIG_LEN, GFP_KERNEL);
+	if (!buf)
+		return 0;
+
+	if (tbs5520se_ctrl_msg(dev, 0xa0, 0xe600, 0, buf, 1,
+			TBS5520SE_READ_MSG) != 1 || (buf[0] & 0x01))
+		goto out;
+
+	if (request_firmware(&fw, props->firmware, &dev->dev))
+		goto out;
+	len = min_t(int, fw->size, TBS5520SE_FW_SIG_LEN);
+	if (tbs5520se_ctrl_msg(dev, 0xa0, 0, 0, buf, len,
+			TBS5520SE_READ_MSG) == len && !memcmp(buf, fw->data, len)) {
+		info("TBS5520se firmware already running, skipping download");
+		*cold = 0;
+	}
+	release_firmware(fw);
+out:
+	kfree(buf);
+	return 0;
+}
+
+static void tbs5520se_priv_destroy(struct dvb_usb_device *d)
+{
+	struct tbs5520se_state *st = d->priv;
+	int i;
+
+	for (i = 0; i < TBS5520SE_CTRL_BUFS; i++) {
+		usb_free_urb(st->ctrl_urb[i]);
+		st->ctrl_urb[i] = NULL;
+		kfree(st->ctrl_buf[i]);
+		st->ctrl_buf[i] = NULL;
+	}
+	kfree(st->ctrl_setup);
+	st->ctrl_setup = NULL;
+	if (st->nvmem)
+		nvmem_unregister(st->nvmem);
+	st->nvmem = NULL;
+}
+
+static int tbs5520se_priv_init(struct dvb_usb_device *d)
+{
+	struct tbs5520se_state *st = d->priv;
+	int i;
+
+	init_usb_anchor(&st->ctrl_anchor);
+	st->ctrl_setup = kmalloc_array(TBS5520SE_CTRL_BUFS,
+				sizeof(*st->ctrl_setup), GFP_KERNEL);
+	if (!st->ctrl_setup)
+		return -ENOMEM;
+
+	for (i = 0; i < TBS5520SE_CTRL_BUFS; i++) {
+		st->ctrl_buf[i] = kmalloc(TBS5520SE_CTRL_BUFSIZE, GFP_KERNEL);
+		st->ctrl_urb[i] = usb_alloc_urb(0, GFP_KERNEL);
+		if (!st->ctrl_buf[i] || !st->ctrl_urb[i]) {
+			tbs5520se_priv_destroy(d);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
 static struct dvb_usb_device_properties tbs5520se_properties = {
 	.caps = DVB_USB_IS_AN_I2C_ADAPTER,
 	.usb_ctrl = DEVICE_SPECIFIC,
 	.firmware = "dvb-usb-id5520se.fw",
 	.size_of_priv = sizeof(struct tbs5520se_state),
+	.priv_init = tbs5520se_priv_init,
+	.priv_destroy = tbs5520se_priv_destroy,
 	.no_reconnect = 1,
 
 	.i2c_algo = &tbs5520se_i2c_algo,
@@ -404,6 +849,7 @@ static struct dvb_usb_device_properties tbs5520se_properties = {
 	.generic_bulk_ctrl_endpoint = 0x81,
 	/* parameter for the MPEG2-data transfer */
 	.num_adapters = 1,
+	.identify_state = tbs5520se_identify_state,
 	.download_firmware = tbs5520se_load_firmware,
 	.read_mac_address = tbs5520se_read_mac_address,
 	.adapter = {{
@@ -450,6 +896,9 @@ static void tbs5520se_disconnect(struct usb_interface *intf)
 	struct dvb_usb_device *d = usb_get_intfdata(intf);
 	struct tbs5520se_state *st = d->priv;
 
+	deb_info("%ld control transfers served from preallocated buffers\n",
+		atomic_long_read(&st->ctrl_allocs_avoided));
+
 	if(st->fe_ter) {
 		dvb_unregister_frontend(st->fe_ter);
 		dvb_frontend_detach(st->fe_ter);
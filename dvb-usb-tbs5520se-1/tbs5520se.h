@@ -4,5 +4,6 @@
 #define DVB_USB_LOG_PREFIX "tbs5520se"
 #include "dvb-usb.h"
 
+#define deb_info(args...) dprintk(dvb_usb_tbs5520se_debug, 0x01, args)
 #define deb_xfer(args...) dprintk(dvb_usb_tbs5520se_debug, 0x02, args)
 #endif